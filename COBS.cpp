@@ -19,6 +19,25 @@
 
 #include "COBS.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COBS_HAVE_X86_SIMD 1
+#else
+#define COBS_HAVE_X86_SIMD 0
+#endif
+
+/* define SIMD_MIN_ENCODE for the smallest frame encode() hands to a SIMD
+ * engine: below it no run gets long enough to search, so the scalar engine
+ * is as fast and skips the indirect call */
+#define SIMD_MIN_ENCODE 32
+/* define SHORT_RUN for how long a run gets in encodeRuns()'s byte loop before
+ * the SIMD search takes over: shorter runs are cheaper a byte at a time than
+ * with a search + memcpy call */
+#define SHORT_RUN 16
+
 using std::cout;
 using std::endl;
 
@@ -29,12 +48,101 @@ COBS::COBS()
 {
 };
 
+COBSDecoder::COBSDecoder()
+{
+};
+
 /*****************************************************************************
- * Functions
+ * Marker search engines
  ****************************************************************************/
 
 /* Function Flow
- * --Encode a byte buffer with the COBS encoder.
+ * --Scalar search for the first PACKETMARKER in a buffer.
+ * --Returns the index of the marker, or \p size if there is none.
+ *
+ * Function Params:
+ * buffer:			A pointer to the bytes to search.
+ * size:			The number of bytes in the \p buffer.
+ *
+ */
+static size_t findMarkerScalar(const uint8_t* buffer, size_t size)
+{
+	size_t i = 0;
+
+	for (; i < size; i++)
+	{
+		if (buffer[i] == PACKETMARKER) break;
+	}
+	return i;
+}
+
+#if COBS_HAVE_X86_SIMD
+/* Function Flow
+ * --SSE2 search: compares 16 bytes at a time against PACKETMARKER and picks
+ *   the first match out of the movemask.
+ * --Tail bytes that don't fill a vector fall back to the scalar search.
+ */
+static size_t findMarkerSSE2(const uint8_t* buffer, size_t size)
+{
+	const __m128i marker = _mm_set1_epi8((char)PACKETMARKER);
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(buffer + i));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, marker));
+		if (mask) return i + __builtin_ctz((unsigned)mask);
+	}
+	return i + findMarkerScalar(buffer + i, size - i);
+}
+
+/* Function Flow
+ * --AVX2 search: same as the SSE2 search but 32 bytes per compare. Only
+ *   called when the CPU reports AVX2 (see selectEngines()).
+ * --The tail is searched here too, and every return clears the upper YMM
+ *   halves (vzeroupper): leaving them dirty makes every later SSE
+ *   instruction, memcpy included, pay a transition penalty.
+ */
+__attribute__((target("avx2")))
+static size_t findMarkerAVX2(const uint8_t* buffer, size_t size)
+{
+	const __m256i marker = _mm256_set1_epi8((char)PACKETMARKER);
+	size_t i = 0;
+
+	for (; i + 32 <= size; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, marker));
+		if (mask)
+		{
+			_mm256_zeroupper();
+			return i + __builtin_ctz(mask);
+		}
+	}
+	_mm256_zeroupper();
+
+	if (i + 16 <= size)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(buffer + i));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm256_castsi256_si128(marker)));
+		if (mask) return i + __builtin_ctz((unsigned)mask);
+		i += 16;
+	}
+	for (; i < size; i++)
+	{
+		if (buffer[i] == PACKETMARKER) break;
+	}
+	return i;
+}
+#endif
+
+/*****************************************************************************
+ * Encode engines
+ ****************************************************************************/
+
+/* Function Flow
+ * --Byte-at-a-time encoder. This is the reference implementation and the
+ *   fallback on CPUs without SIMD support.
  * --Return the number of bytes written to the \p encodedBuffer.
  *
  * Function Params:
@@ -42,12 +150,10 @@ COBS::COBS()
  * size:			The number of bytes in the \p buffer.
  * encodedBuffer:	The buffer for the encoded bytes.
  *
- * \warning The encodedBuffer must have at least getEncodedBufferSize() allocated.
- *
  */
-size_t COBS::encode(const uint8_t* buffer,
-                    size_t size,
-                    uint8_t* encodedBuffer)
+static size_t encodeScalar(const uint8_t* buffer,
+                           size_t size,
+                           uint8_t* encodedBuffer)
 {
 	size_t read_index  = 0;
 	size_t write_index = 1;
@@ -93,21 +199,217 @@ size_t COBS::encode(const uint8_t* buffer,
 	return write_index;
 }
 
+#if COBS_HAVE_X86_SIMD
+/* Function Flow
+ * --Byte loop, like encodeScalar(), until a run of non-marker bytes gets
+ *   SHORT_RUN long. Then it asks FindMarker where the next PACKETMARKER is
+ *   (no further than the current code block reaches, 254 bytes at most) and
+ *   copies the rest of the run at once. Marker-dense data never leaves the
+ *   byte loop, so it costs what encodeScalar() does.
+ * --Output is byte-identical to encodeScalar(): a full 254-byte run closes
+ *   its block with code 0xFF and opens a new one, and the frame always ends
+ *   with a trailing PACKETMARKER.
+ *
+ * Function variables:
+ * limit:		Bytes the current code block can still take from the input
+ * run:			Non-marker bytes found before the next marker (or limit)
+ *
+ */
+template <size_t (*FindMarker)(const uint8_t*, size_t)>
+static inline size_t encodeRuns(const uint8_t* buffer,
+                                size_t size,
+                                uint8_t* encodedBuffer)
+{
+	size_t read_index  = 0;
+	size_t write_index = 1;
+	size_t code_index  = 0;
+	uint8_t code       = 1;
+
+	while (read_index < size)
+	{
+		if (buffer[read_index] == PACKETMARKER)
+		{
+			encodedBuffer[code_index] = (code + PACKETMARKER) & 0xFF;
+			code = 1;
+			code_index = write_index++;
+			read_index++;
+			continue;
+		}
+
+		encodedBuffer[write_index++] = buffer[read_index++];
+		code++;
+
+		/* A long run: find where it ends and copy the rest in one go */
+		if (code == SHORT_RUN + 1 && read_index < size)
+		{
+			size_t limit = size - read_index;
+			if (limit > (size_t)(0xFF - code)) limit = 0xFF - code;
+
+			size_t run = FindMarker(buffer + read_index, limit);
+			memcpy(encodedBuffer + write_index, buffer + read_index, run);
+			write_index += run;
+			read_index  += run;
+			code += run;
+		}
+
+		/* Run filled a whole block: close it with 0xFF, no implied marker */
+		if (code == 0xFF)
+		{
+			encodedBuffer[code_index] = (code + PACKETMARKER) & 0xFF;
+			code = 1;
+			code_index = write_index++;
+		}
+	}
+
+	encodedBuffer[code_index] = (code + PACKETMARKER) & 0xFF;
+	encodedBuffer[write_index++] = PACKETMARKER;
+
+	return write_index;
+}
+
+static size_t encodeSSE2(const uint8_t* buffer, size_t size, uint8_t* encodedBuffer)
+{
+	return encodeRuns<findMarkerSSE2>(buffer, size, encodedBuffer);
+}
+
+static size_t encodeAVX2(const uint8_t* buffer, size_t size, uint8_t* encodedBuffer)
+{
+	return encodeRuns<findMarkerAVX2>(buffer, size, encodedBuffer);
+}
+#endif
+
+/*****************************************************************************
+ * Runtime dispatch
+ ****************************************************************************/
+typedef size_t (*EncodeEngine)(const uint8_t*, size_t, uint8_t*);
+typedef size_t (*FindMarkerEngine)(const uint8_t*, size_t);
+
+static FindMarkerEngine findMarkerEngine = findMarkerScalar;
+static EncodeEngine encodeEngine = encodeScalar;
+
+/* Function Flow
+ * --Picks the engine. Runs once, when the library is loaded, so encode()
+ *   only pays for an indirect call. Anything that encodes before then gets
+ *   the scalar engine, which is still correct.
+ * --SSE2 (every x86-64) is the default: in micro_bench it beats the scalar
+ *   engine on 64- and 255-byte payloads and ties it on marker-dense ones.
+ *   AVX2 measured no faster than SSE2 on frames this short, so it is only
+ *   used when asked for.
+ * --HSK_COBS_ENGINE=scalar|sse2|avx2 in the environment picks one, so
+ *   micro_bench can time each against the others.
+ */
+static bool selectEngines()
+{
+#if COBS_HAVE_X86_SIMD
+	const char* forced = getenv("HSK_COBS_ENGINE");
+
+	if (forced && !strcmp(forced, "scalar")) return true;
+
+	__builtin_cpu_init();
+	if (forced && !strcmp(forced, "avx2") && __builtin_cpu_supports("avx2"))
+	{
+		findMarkerEngine = findMarkerAVX2;
+		encodeEngine = encodeAVX2;
+	}
+	else
+	{
+		findMarkerEngine = findMarkerSSE2;
+		encodeEngine = encodeSSE2;
+	}
+#endif
+	return true;
+}
+
+static bool enginesSelected = selectEngines();
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function Flow
+ * --Encode a byte buffer with the COBS encoder.
+ * --Return the number of bytes written to the \p encodedBuffer.
+ * --Frames of SIMD_MIN_ENCODE bytes or more run on the SSE2/AVX2 engine
+ *   when available, everything else on the scalar one. All engines produce
+ *   the same bytes.
+ *
+ * Function Params:
+ * buffer:			A pointer to the unencoded buffer to encode.
+ * size:			The number of bytes in the \p buffer.
+ * encodedBuffer:	The buffer for the encoded bytes.
+ *
+ * \warning The encodedBuffer must have at least getEncodedBufferSize() allocated.
+ *
+ */
+size_t COBS::encode(const uint8_t* buffer,
+                    size_t size,
+                    uint8_t* encodedBuffer)
+{
+	if (size < SIMD_MIN_ENCODE) return encodeScalar(buffer, size, encodedBuffer);
+	return encodeEngine(buffer, size, encodedBuffer);
+}
+
+/* Function Flow
+ * --Find the first PACKETMARKER in a buffer, using the same SIMD engine as
+ *   encode().
+ * --Return the index of the marker, or \p size if the buffer has none.
+ *
+ * Function Params:
+ * buffer:			A pointer to the bytes to search.
+ * size:			The number of bytes in the \p buffer.
+ *
+ */
+size_t COBS::findMarker(const uint8_t* buffer, size_t size)
+{
+	return findMarkerEngine(buffer, size);
+}
+
 /* Function Flow
  * --Decode a COBS-encoded buffer.
- * --Return the number of bytes written to the \p decodedBuffer.
+ * --Return the number of bytes written to the \p decodedBuffer, or 0 if the
+ *   encoding is broken.
  *
  * Function Params:
  * encodedbuffer:	A pointer to the \p encodedBuffer to decode.
  * size:			The number of bytes in the \p encodedBuffer.
  * decodedBuffer:	The target buffer for the decoded bytes.
  *
- * \warning ecodedBuffer must have a minimum capacity of size.
+ * \warning decodedBuffer must have a minimum capacity of size.
  *
  */
 size_t COBS::decode(const uint8_t* encodedBuffer,
                     size_t size,
                     uint8_t* decodedBuffer)
+{
+	/* A block never decodes to more bytes than it takes up encoded */
+	return decode(encodedBuffer, size, decodedBuffer, size);
+}
+
+/* Function Flow
+ * --Walk the chain of code bytes first, without copying anything. Every code
+ *   must describe a block that fits in what is left of the encoded buffer,
+ *   and the decoded total must fit in \p decodedBufferSize. If either fails,
+ *   nothing is written and 0 is returned.
+ * --Then copy each block's run with one memcpy (glibc's memcpy is already
+ *   SIMD for these sizes) and put back the PACKETMARKER it stood in for.
+ * --Return the number of bytes written to the \p decodedBuffer.
+ *
+ * Function Params:
+ * encodedbuffer:		A pointer to the \p encodedBuffer to decode, without
+ *						the trailing PACKETMARKER.
+ * size:				The number of bytes in the \p encodedBuffer.
+ * decodedBuffer:		The target buffer for the decoded bytes.
+ * decodedBufferSize:	How many bytes \p decodedBuffer can hold.
+ *
+ * Function variables:
+ * code:		Length of the current block, code byte included
+ * decodedSize:	Running total of bytes the decode will write
+ *
+ */
+size_t COBS::decode(const uint8_t* encodedBuffer,
+                    size_t size,
+                    uint8_t* decodedBuffer,
+                    size_t decodedBufferSize)
 {
 	if (size == 0) {
 		return 0;
@@ -115,37 +417,45 @@ size_t COBS::decode(const uint8_t* encodedBuffer,
 
 	size_t read_index  = 0;
 	size_t write_index = 0;
+	size_t decodedSize = 0;
 	uint8_t code       = 0;
-	uint8_t i          = 0;
 
-	/* while the current byte being read is inside the message string*/
+	/* Validate every code byte before touching the output */
 	while (read_index < size)
 	{
-		/* the first code byte is the # of bytes we'll have to read until the
-		    next packetMarker is hit */
 		code = (encodedBuffer[read_index] - PACKETMARKER) & 0xFF;
 
-		/* NOTE!!!!
-		    --size + 1 vs. size
-		    This is some hiccup with the C++ here. The compiler evaluates
-		    the '>' operator as >=, so we need to include a +1 after size*/
-		/* if the 'code' is read and says that the next zero is outside the packet,
-		    this shit is broke, so end the program */
-		if (read_index + code > size + 1 && code != 1)
+		/* A PACKETMARKER can't be a code, and a block can't run past the end */
+		if (code == 0 || code > size - read_index)
 		{
 			return 0;
 		}
 
-		read_index++;
+		read_index  += code;
+		decodedSize += code - 1;
 
-		/* write the non-encoded bits to the buffer until the next packetMarker */
-		for (i = 1; i < code; i++)
+		/* Every block but a full one and the last one stands for a marker */
+		if (code != 0xFF && read_index != size)
 		{
-			decodedBuffer[write_index++] = encodedBuffer[read_index++];
+			decodedSize++;
 		}
-		/* as long as the next zero is not 255 bytes away and we are not currently
-		    reading the last bit of the message, write a zero where the previous 'code'
-		    marker was in the encoded message. */
+	}
+
+	if (decodedSize > decodedBufferSize)
+	{
+		return 0;
+	}
+
+	/* The chain is good: copy the runs */
+	read_index = 0;
+	while (read_index < size)
+	{
+		code = (encodedBuffer[read_index++] - PACKETMARKER) & 0xFF;
+
+		memcpy(decodedBuffer + write_index, encodedBuffer + read_index, code - 1);
+		write_index += code - 1;
+		read_index  += code - 1;
+
 		if (code != 0xFF && read_index != size)
 		{
 			decodedBuffer[write_index++] = PACKETMARKER;
@@ -166,3 +476,193 @@ size_t COBS::getEncodedBufferSize(size_t unencodedBufferSize)
 {
 	return unencodedBufferSize + unencodedBufferSize / 254 + 2;
 }
+
+/*****************************************************************************
+ * Streaming decoder
+ ****************************************************************************/
+
+/* Function Flow
+ * --Sets the buffer decoded frames are written into. Changing the buffer
+ *   throws away any partially received frame.
+ *
+ * Function Params:
+ * decodedBuffer:		The target buffer for decoded frames.
+ * decodedBufferSize:	How many bytes \p decodedBuffer can hold. Longer frames
+ *						are dropped.
+ *
+ */
+void COBSDecoder::setOutput(uint8_t* decodedBuffer, size_t decodedBufferSize)
+{
+	if (decodedBuffer == _output && decodedBufferSize == _outputSize) return;
+
+	_output = decodedBuffer;
+	_outputSize = decodedBufferSize;
+	reset();
+}
+
+/* Function Flow
+ * --Sets the function called with each good frame. The frame lives in the
+ *   output buffer and is only valid until the next feed().
+ *
+ * Function Params:
+ * FrameDecodedFunction:	user-defined function location in memory
+ * context:					handed back to the function untouched
+ *
+ */
+void COBSDecoder::setFrameHandler(FrameHandlerFunction FrameDecodedFunction,
+                                  void * context)
+{
+	_FrameDecodedFunction = FrameDecodedFunction;
+	_context = context;
+}
+
+/* Function Flow
+ * --Forgets the frame being received. The next byte is read as the first
+ *   code byte of a new frame.
+ */
+void COBSDecoder::reset()
+{
+	_writeIndex = 0;
+	_sum = 0;
+	_code = 0;
+	_remaining = 0;
+	_markerPending = false;
+	_overflow = false;
+	_inFrame = false;
+}
+
+/* Function Flow
+ * --Called when a PACKETMARKER ends the frame.
+ * --Hands the frame to the handler if every block arrived whole and it fit
+ *   in the output buffer. Back-to-back markers (empty frames) are ignored.
+ */
+void COBSDecoder::endFrame()
+{
+	if (_inFrame)
+	{
+		if (_remaining != 0 || _overflow)
+		{
+			_framesDropped++;
+		}
+		else
+		{
+			_framesDecoded++;
+			if (_FrameDecodedFunction)
+			{
+				_FrameDecodedFunction(_context, _output, _writeIndex);
+			}
+		}
+	}
+	reset();
+}
+
+/* Function Flow
+ * --Copies a run of decoded bytes and adds them to the running sum in the
+ *   same pass, instead of a memcpy now and a checksum pass over the frame
+ *   later. With SSE2, 16 bytes per step: psadbw sums them into two 64-bit
+ *   lanes that only need folding mod 256 at the end
+ * --Returns the new sum mod 256
+ *
+ */
+static inline uint8_t copyAndSum(uint8_t* out, const uint8_t* in, size_t size, uint8_t sum)
+{
+	size_t i = 0;
+
+#if COBS_HAVE_X86_SIMD && defined(__SSE2__)
+	__m128i total = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+		_mm_storeu_si128((__m128i*)(out + i), block);
+		total = _mm_add_epi64(total, _mm_sad_epu8(block, _mm_setzero_si128()));
+	}
+	sum += (uint8_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total)));
+#endif
+
+	for (; i < size; i++)
+	{
+		out[i] = in[i];
+		sum += in[i];
+	}
+	return sum;
+}
+
+/* Function Flow
+ * --Decodes a chunk of the encoded stream.
+ * --Between blocks, a byte is either the PACKETMARKER that ends the frame or
+ *   the next code byte. The marker that the previous block stood for is only
+ *   written once we know another block follows.
+ * --Inside a block, the rest of the run is searched for a stray PACKETMARKER
+ *   and copied in one go, adding it to the frame's sum (see frameSum()). A
+ *   marker in the middle of a run means the frame was cut short: it is
+ *   dropped and the marker starts the next one.
+ * --Returns the number of frames handed to the frame handler.
+ *
+ * Function Params:
+ * encodedBytes:	The next bytes of the stream, as read from the port.
+ * size:			The number of bytes in \p encodedBytes.
+ *
+ */
+size_t COBSDecoder::feed(const uint8_t* encodedBytes, size_t size)
+{
+	size_t read_index = 0;
+	size_t framesBefore = _framesDecoded;
+
+	while (read_index < size)
+	{
+		if (_remaining == 0)
+		{
+			uint8_t byte = encodedBytes[read_index++];
+
+			if (byte == PACKETMARKER)
+			{
+				endFrame();
+				continue;
+			}
+
+			_inFrame = true;
+			if (_markerPending)
+			{
+				if (_writeIndex < _outputSize) _output[_writeIndex++] = PACKETMARKER;
+				else _overflow = true;
+				_sum += PACKETMARKER;
+				_markerPending = false;
+			}
+
+			_code = (byte - PACKETMARKER) & 0xFF;
+			_remaining = _code - 1;
+		}
+		else
+		{
+			size_t run = size - read_index;
+			if (run > _remaining) run = _remaining;
+
+			size_t marker = COBS::findMarker(encodedBytes + read_index, run);
+			if (marker < run)
+			{
+				read_index += marker + 1;
+				endFrame();
+				continue;
+			}
+
+			if (!_overflow && _writeIndex + run <= _outputSize)
+			{
+				_sum = copyAndSum(_output + _writeIndex, encodedBytes + read_index, run, _sum);
+				_writeIndex += run;
+			}
+			else
+			{
+				_overflow = true;
+			}
+			read_index += run;
+			_remaining -= run;
+		}
+
+		/* Block complete: it stands for a marker unless it was a full one */
+		if (_remaining == 0)
+		{
+			_markerPending = (_code != 0xFF);
+		}
+	}
+	return _framesDecoded - framesBefore;
+}
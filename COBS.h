@@ -32,7 +32,74 @@ static size_t decode(const uint8_t* encodedBuffer,
                      size_t size,
                      uint8_t* decodedBuffer);
 
+static size_t decode(const uint8_t* encodedBuffer,
+                     size_t size,
+                     uint8_t* decodedBuffer,
+                     size_t decodedBufferSize);
+
 static size_t getEncodedBufferSize(size_t unencodedBufferSize);
+
+static size_t findMarker(const uint8_t* buffer, size_t size);
+};
+
+/* Resumable COBS decoder for a byte stream. Feed it whatever read() returned;
+ * it decodes straight into the output buffer as bytes arrive and calls the
+ * frame handler each time a PACKETMARKER closes a good frame. A frame can be
+ * split across feed() calls at any byte.
+ */
+class COBSDecoder
+{
+public:
+
+COBSDecoder();
+
+/* typedef for On-frame-decoded function */
+typedef void (*FrameHandlerFunction)(void * context,
+                                     const uint8_t * buffer,
+                                     size_t size);
+
+void setOutput(uint8_t* decodedBuffer, size_t decodedBufferSize);
+void setFrameHandler(FrameHandlerFunction FrameDecodedFunction, void * context);
+
+size_t feed(const uint8_t* encodedBytes, size_t size);
+void reset();
+
+/* State of the frame currently being received */
+bool inFrame() const { return _inFrame; }
+const uint8_t* output() const { return _output; }
+size_t decodedSize() const { return _writeIndex; }
+
+/* Sum mod 256 of every byte decoded into the frame so far, added up while
+ * the bytes are copied. Inside the frame handler it covers the whole frame,
+ * so a checksum can be verified without reading the frame again */
+uint8_t frameSum() const { return _sum; }
+
+/* Running totals since construction */
+size_t framesDecoded() const { return _framesDecoded; }
+size_t framesDropped() const { return _framesDropped; }
+
+private:
+void endFrame();
+
+/* Where decoded bytes go */
+uint8_t* _output = 0;
+size_t _outputSize = 0;
+size_t _writeIndex = 0;
+uint8_t _sum = 0;
+
+/* Decoder state that carries over between feed() calls */
+uint8_t _code = 0;			// Code byte of the block being read
+uint8_t _remaining = 0;		// Bytes of that block still to come
+bool _markerPending = false;	// A marker goes out if another block follows
+bool _overflow = false;		// Frame outgrew the output buffer
+bool _inFrame = false;		// Bytes arrived since the last PACKETMARKER
+
+/* On-frame-decoded function initialization */
+FrameHandlerFunction _FrameDecodedFunction = 0;
+void * _context = 0;
+
+size_t _framesDecoded = 0;
+size_t _framesDropped = 0;
 };
 
 #endif // COBS_H
@@ -0,0 +1,247 @@
+/*
+ * CRC.cpp
+ *
+ * Defines the CRC class.
+ *
+ * Both CRCs are table driven, 8 bytes per step (slice-by-8): table k holds
+ * the CRC of a byte followed by k zero bytes, so 8 lookups XORed together
+ * advance the CRC by 8 bytes with no dependency between the lookups.
+ * CRC-32C uses the SSE4.2 crc32 instruction instead when the CPU has it.
+ *
+ */
+
+#include "CRC.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_HAVE_X86_SIMD 1
+#else
+#define CRC_HAVE_X86_SIMD 0
+#endif
+
+/*****************************************************************************
+ * Tables
+ ****************************************************************************/
+#define CRC16_POLY 0x1021
+#define CRC32C_POLY 0x82F63B78	// 0x1EDC6F41 bit-reversed
+
+static uint16_t crc16Table[8][256];
+static uint32_t crc32cTable[8][256];
+
+/* Function Flow
+ * --Fills both sets of slice-by-8 tables.
+ * --Table 0 is the classic byte-at-a-time table. Table k is table k-1
+ *   pushed through one more zero byte.
+ */
+static void buildTables()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		uint16_t crc16 = (uint16_t)(i << 8);
+		uint32_t crc32 = (uint32_t)i;
+
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc16 = (crc16 & 0x8000) ? (uint16_t)((crc16 << 1) ^ CRC16_POLY) : (uint16_t)(crc16 << 1);
+			crc32 = (crc32 & 1) ? (crc32 >> 1) ^ CRC32C_POLY : crc32 >> 1;
+		}
+		crc16Table[0][i] = crc16;
+		crc32cTable[0][i] = crc32;
+	}
+
+	for (int k = 1; k < 8; k++)
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			uint16_t prev16 = crc16Table[k - 1][i];
+			uint32_t prev32 = crc32cTable[k - 1][i];
+			crc16Table[k][i] = (uint16_t)(prev16 << 8) ^ crc16Table[0][prev16 >> 8];
+			crc32cTable[k][i] = (prev32 >> 8) ^ crc32cTable[0][prev32 & 0xFF];
+		}
+	}
+}
+
+/*****************************************************************************
+ * Engines
+ ****************************************************************************/
+
+/* Function Flow
+ * --CRC-16/CCITT, 8 bytes per step. The CRC is MSB first, so its two bytes
+ *   fold into the first two bytes of each step.
+ */
+static uint16_t crc16Slice8(const uint8_t* buffer, size_t size)
+{
+	uint16_t crc = 0xFFFF;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const uint8_t* b = buffer + i;
+		crc = crc16Table[7][b[0] ^ (crc >> 8)] ^ crc16Table[6][b[1] ^ (crc & 0xFF)] ^
+		      crc16Table[5][b[2]] ^ crc16Table[4][b[3]] ^
+		      crc16Table[3][b[4]] ^ crc16Table[2][b[5]] ^
+		      crc16Table[1][b[6]] ^ crc16Table[0][b[7]];
+	}
+	for (; i < size; i++)
+	{
+		crc = (uint16_t)(crc << 8) ^ crc16Table[0][(crc >> 8) ^ buffer[i]];
+	}
+	return crc;
+}
+
+/* Function Flow
+ * --CRC-32C from the tables, 8 bytes per step. The CRC is reflected (LSB
+ *   first), so it folds into the first four bytes of each step.
+ */
+static uint32_t crc32cSlice8(const uint8_t* buffer, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const uint8_t* b = buffer + i;
+		uint32_t low = crc ^ ((uint32_t)b[0] | (uint32_t)b[1] << 8 |
+		                      (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24);
+		crc = crc32cTable[7][low & 0xFF] ^ crc32cTable[6][(low >> 8) & 0xFF] ^
+		      crc32cTable[5][(low >> 16) & 0xFF] ^ crc32cTable[4][low >> 24] ^
+		      crc32cTable[3][b[4]] ^ crc32cTable[2][b[5]] ^
+		      crc32cTable[1][b[6]] ^ crc32cTable[0][b[7]];
+	}
+	for (; i < size; i++)
+	{
+		crc = (crc >> 8) ^ crc32cTable[0][(crc ^ buffer[i]) & 0xFF];
+	}
+	return ~crc;
+}
+
+#if CRC_HAVE_X86_SIMD
+/* Function Flow
+ * --CRC-32C on the SSE4.2 crc32 instruction: 8 bytes per instruction on
+ *   x86-64, then the tail a byte at a time. Only called when the CPU reports
+ *   SSE4.2 (see selectEngines()).
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSSE42(const uint8_t* buffer, size_t size)
+{
+	size_t i = 0;
+
+#if defined(__x86_64__)
+	uint64_t crc = 0xFFFFFFFF;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, buffer + i, 8);
+		crc = _mm_crc32_u64(crc, word);
+	}
+	uint32_t crc32 = (uint32_t)crc;
+#else
+	uint32_t crc32 = 0xFFFFFFFF;
+	for (; i + 4 <= size; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, buffer + i, 4);
+		crc32 = _mm_crc32_u32(crc32, word);
+	}
+#endif
+	for (; i < size; i++)
+	{
+		crc32 = _mm_crc32_u8(crc32, buffer[i]);
+	}
+	return ~crc32;
+}
+#endif
+
+/*****************************************************************************
+ * Runtime dispatch
+ ****************************************************************************/
+typedef uint16_t (*Crc16Engine)(const uint8_t*, size_t);
+typedef uint32_t (*Crc32cEngine)(const uint8_t*, size_t);
+
+static uint16_t crc16First(const uint8_t* buffer, size_t size);
+static uint32_t crc32cFirst(const uint8_t* buffer, size_t size);
+
+static Crc16Engine crc16Engine = crc16First;
+static Crc32cEngine crc32cEngine = crc32cFirst;
+static bool crc32cInHardware = false;
+
+/* Function Flow
+ * --Builds the tables and picks the CRC-32C engine for the CPU running us.
+ *   Runs once, when the library is loaded. A CRC asked for before then
+ *   (another file's static initializer) goes through crc16First/crc32cFirst,
+ *   which run it first.
+ */
+static bool selectEngines()
+{
+	buildTables();
+	crc16Engine = crc16Slice8;
+	crc32cEngine = crc32cSlice8;
+
+#if CRC_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		crc32cEngine = crc32cSSE42;
+		crc32cInHardware = true;
+	}
+#endif
+	return true;
+}
+
+static uint16_t crc16First(const uint8_t* buffer, size_t size)
+{
+	selectEngines();
+	return crc16Engine(buffer, size);
+}
+
+static uint32_t crc32cFirst(const uint8_t* buffer, size_t size)
+{
+	selectEngines();
+	return crc32cEngine(buffer, size);
+}
+
+static bool enginesSelected = selectEngines();
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function Flow
+ * --Returns the CRC-16/CCITT of a buffer.
+ *
+ * Function Params:
+ * buffer:		A pointer to the bytes to check.
+ * size:		The number of bytes in the \p buffer.
+ *
+ */
+uint16_t CRC::crc16(const uint8_t* buffer, size_t size)
+{
+	return crc16Engine(buffer, size);
+}
+
+/* Function Flow
+ * --Returns the CRC-32C of a buffer, on the SSE4.2 engine when available.
+ *   Both engines give the same value.
+ *
+ * Function Params:
+ * buffer:		A pointer to the bytes to check.
+ * size:		The number of bytes in the \p buffer.
+ *
+ */
+uint32_t CRC::crc32c(const uint8_t* buffer, size_t size)
+{
+	return crc32cEngine(buffer, size);
+}
+
+bool CRC::hardwareCrc32c()
+{
+	return crc32cInHardware;
+}
+
+uint32_t CRC::crc32cTables(const uint8_t* buffer, size_t size)
+{
+	if (!enginesSelected) selectEngines();
+	return crc32cSlice8(buffer, size);
+}
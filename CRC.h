@@ -0,0 +1,35 @@
+/*
+ * CRC.h
+ *
+ * Declares the CRCs a packet trailer can carry instead of the 1-byte sum
+ * (see iProtocol.h):
+ *	--CRC-16/CCITT (poly 0x1021, init 0xFFFF, not reflected), slice-by-8
+ *	--CRC-32C (Castagnoli, poly 0x1EDC6F41 reflected), with the SSE4.2 crc32
+ *	  instruction when the CPU has it, slice-by-8 tables when it doesn't
+ *
+ */
+
+#ifndef CRC_h
+#define CRC_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class CRC
+{
+public:
+
+/* crc16("123456789") == 0x29B1 */
+static uint16_t crc16(const uint8_t* buffer, size_t size);
+
+/* crc32c("123456789") == 0xE3069283 */
+static uint32_t crc32c(const uint8_t* buffer, size_t size);
+
+/* TRUE if crc32c() runs on the SSE4.2 instruction */
+static bool hardwareCrc32c();
+
+/* crc32c() on the tables even when SSE4.2 is there, for comparing */
+static uint32_t crc32cTables(const uint8_t* buffer, size_t size);
+};
+
+#endif // CRC_h
@@ -0,0 +1,266 @@
+/*
+ * CommandScript.cpp
+ *
+ * Defines the CommandScript class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "CommandScript.h"
+#include "iProtocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parses a whole number of at most 'max' (decimal, or 0x hex) */
+static bool parseNumber(const std::string & word, unsigned long max, unsigned long & value)
+{
+	char * end;
+
+	errno = 0;
+	value = strtoul(word.c_str(), &end, 0);
+	return !word.empty() && word[0] != '-' && *end == 0 && errno == 0 && value <= max;
+}
+
+/* Parses a number of seconds: not negative, at most a day */
+static bool parseSeconds(const std::string & word, double & value)
+{
+	char * end;
+
+	value = strtod(word.c_str(), &end);
+	return !word.empty() && *end == 0 && value >= 0 && value <= 86400;
+}
+
+/*****************************************************************************
+ * Contructor
+ ****************************************************************************/
+CommandScript::CommandScript()
+	: _step(0), _done(0), _sent(0)
+{
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Reads a script file and adds its steps to the end of this script
+ * --Returns FALSE if the file can't be read or a line is bad
+ *
+ */
+bool CommandScript::load(const char * path)
+{
+	FILE * file = fopen(path, "r");
+	std::string text;
+	char chunk[4096];
+	size_t n;
+
+	if (!file)
+	{
+		printf("error %d opening %s: %s\n", errno, path, strerror(errno));
+		return false;
+	}
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) text.append(chunk, n);
+	fclose(file);
+
+	return parse(text.c_str(), path);
+}
+
+/* Function flow:
+ * --Splits the text into steps at newlines and ';'s, and adds them to the
+ *   end of this script
+ * --Stops at the first bad step. Returns FALSE if there was one
+ *
+ * Function params:
+ * text:		Script text (see CommandScript.h)
+ * origin:		Name of where it came from, for messages
+ *
+ */
+bool CommandScript::parse(const char * text, const char * origin)
+{
+	int line = 1;
+	std::string step;
+
+	for (const char * p = text; ; p++)
+	{
+		if (*p == '\n' || *p == ';' || *p == 0)
+		{
+			if (!parseStep(step, origin, line)) return false;
+			step.clear();
+			if (*p == 0) return true;
+			if (*p == '\n') line++;
+		}
+		else step += *p;
+	}
+}
+
+/* Function flow:
+ * --Parses one step: a wait, or a destination, command, payload bytes and
+ *   keywords
+ * --Blank steps and comments add nothing
+ *
+ */
+bool CommandScript::parseStep(const std::string & text, const char * origin, int line)
+{
+	std::vector<std::string> words;
+	script_step_t step;
+	unsigned long value;
+
+	size_t comment = text.find('#');
+	std::string code = text.substr(0, comment);
+	for (char * word = strtok(&code[0], " \t\r"); word; word = strtok(0, " \t\r"))
+	{
+		words.push_back(word);
+	}
+	if (words.empty()) return true;
+
+	step.send = true;
+	step.dst = 0;
+	step.cmd = 0;
+	step.repeat = 1;
+	step.interval = 0;
+	step.overrideTrailer = false;
+	step.trailer = 0;
+	step.line = line;
+
+	if (words[0] == "wait")
+	{
+		if (words.size() != 2 || !parseSeconds(words[1], step.interval))
+		{
+			printf("%s:%d: expected 'wait SECONDS'\n", origin, line);
+			return false;
+		}
+		step.send = false;
+		_steps.push_back(step);
+		return true;
+	}
+
+	if (words.size() < 2 || !parseNumber(words[0], 255, value))
+	{
+		printf("%s:%d: expected a destination and a command\n", origin, line);
+		return false;
+	}
+	step.dst = value;
+	if (!parseNumber(words[1], 255, value))
+	{
+		printf("%s:%d: bad command '%s'\n", origin, line, words[1].c_str());
+		return false;
+	}
+	step.cmd = value;
+
+	size_t i = 2;
+	for (; i < words.size() && parseNumber(words[i], 255, value); i++)
+	{
+		step.payload.push_back(value);
+	}
+	if (step.payload.size() > 255)
+	{
+		printf("%s:%d: more than 255 payload bytes\n", origin, line);
+		return false;
+	}
+
+	for (; i < words.size(); i += 2)
+	{
+		const std::string & keyword = words[i];
+		bool good = i + 1 < words.size();
+
+		if (good && keyword == "repeat")
+		{
+			good = parseNumber(words[i + 1], UINT32_MAX, value) && value > 0;
+			step.repeat = value;
+		}
+		else if (good && keyword == "every") good = parseSeconds(words[i + 1], step.interval);
+		else if (good && keyword == "checksum")
+		{
+			good = parseNumber(words[i + 1], UINT32_MAX, value);
+			step.overrideTrailer = true;
+			step.trailer = value;
+		}
+		else good = false;
+
+		if (!good)
+		{
+			printf("%s:%d: bad '%s' (expected repeat N, every SECONDS or checksum VALUE)\n",
+			       origin, line, keyword.c_str());
+			return false;
+		}
+	}
+
+	_steps.push_back(step);
+	return true;
+}
+
+bool CommandScript::done() const
+{
+	return _step >= _steps.size();
+}
+
+/* Function flow:
+ * --Puts the current step's header and payload in the outgoing packet
+ * --Computes its trailer in the integrity mode of the destination, unless
+ *   the step gives its own. One too wide for that mode is cut to fit
+ * --Returns the size to send, or 0 if the step is a wait (or the script is
+ *   over)
+ *
+ * Function params:
+ * out:			Builder over the outgoing packet
+ * src:			This device's address
+ *
+ */
+size_t CommandScript::fill(const PacketBuilder & out, uint8_t src) const
+{
+	if (done() || !_steps[_step].send) return 0;
+
+	const script_step_t & step = _steps[_step];
+	integrity_mode_t mode = getIntegrity(step.dst);
+	size_t size = 4 + step.payload.size() + trailerSize(mode);
+
+	if (size > out.capacity()) return 0;
+	out.setHeader(src, step.dst, step.cmd, step.payload.size());
+	if (!step.payload.empty()) memcpy(out.payload(), step.payload.data(), step.payload.size());
+
+	out.finish();
+	if (step.overrideTrailer) writeTrailer(out.data(), mode, step.trailer);
+	return size;
+}
+
+/* Function flow:
+ * --Counts one send of the current step (or the end of a wait), and moves
+ *   to the next step once it has been sent 'repeat' times
+ * --Returns the seconds to wait before the next fill()
+ *
+ */
+double CommandScript::advance()
+{
+	if (done()) return 0;
+
+	const script_step_t & step = _steps[_step];
+	if (step.send) _sent++;
+	if (++_done >= step.repeat)
+	{
+		_done = 0;
+		_step++;
+	}
+	return step.interval;
+}
+
+/* Starts the script over from its first step */
+void CommandScript::rewind()
+{
+	_step = 0;
+	_done = 0;
+}
+
+size_t CommandScript::numSteps() const
+{
+	return _steps.size();
+}
+
+uint64_t CommandScript::packetsSent() const
+{
+	return _sent;
+}
@@ -0,0 +1,81 @@
+/*
+ * CommandScript.h
+ *
+ * Declares command scripts: lists of packets for the host to send on its
+ * own, instead of one at a time through the setup() prompts. A script is
+ * text, one step per line (or per ';' on the command line):
+ *
+ *	# Ping the main board, then read the magnet board's probes 10 times a second
+ *	1 0
+ *	2 16 repeat 100 every 0.1
+ *	wait 2
+ *	3 1 250 3			# Payload bytes follow the command
+ *	2 0 checksum 17		# Send this trailer instead of the right one
+ *
+ * A step is a destination, a command and its payload bytes (decimal or 0x),
+ * then any of:
+ *	repeat N		Send it N times (1)
+ *	every S			Seconds between those sends, and before the next step (0)
+ *	checksum V		Trailer to send instead of the computed one, to test how
+ *					the boards handle a bad packet
+ * "wait S" waits S seconds before the next step. '#' starts a comment.
+ *
+ * The script only says what goes out when; the caller sends the packets
+ * and keeps the time (see scriptTimedOut() in main.cpp), so incoming
+ * packets are still handled while a script runs.
+ *
+ */
+
+#ifndef CommandScript_h
+#define CommandScript_h
+
+#include "Packet.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* One line of a script */
+typedef struct script_step_t
+{
+	bool send;				// FALSE for a wait
+	uint8_t dst;
+	uint8_t cmd;
+	std::vector<uint8_t> payload;
+	uint32_t repeat;
+	double interval;		// Seconds after each send (or the wait)
+	bool overrideTrailer;
+	uint32_t trailer;
+	int line;				// Where the step came from, for messages
+} script_step_t;
+
+class CommandScript
+{
+public:
+CommandScript();
+
+/* Reading in. Both print what's wrong and return FALSE on a bad line */
+bool load(const char * path);
+bool parse(const char * text, const char * origin);
+
+/* Running. fill() puts the current step's packet in 'out', trailer included,
+ * and returns its size (0 for a wait). advance() moves past one send of it
+ * and returns the seconds to wait before the next */
+bool done() const;
+size_t fill(const PacketBuilder & out, uint8_t src) const;
+double advance();
+void rewind();
+
+size_t numSteps() const;
+uint64_t packetsSent() const;
+
+private:
+bool parseStep(const std::string & text, const char * origin, int line);
+
+std::vector<script_step_t> _steps;
+size_t _step;			// Step being run
+uint32_t _done;			// Its sends so far
+uint64_t _sent;			// Sends of the whole script so far
+};
+
+#endif // CommandScript_h
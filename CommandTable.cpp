@@ -0,0 +1,120 @@
+/*
+ * CommandTable.cpp
+ *
+ * Defines the CommandTable class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "CommandTable.h"
+
+#include <new>
+#include <string.h>
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+CommandTable::CommandTable()
+{
+	memset(_bySource, 0, sizeof(_bySource));
+	memset(_anySource, 0, sizeof(_anySource));
+	memset(&_default, 0, sizeof(_default));
+	_default.maxLength = 255;
+}
+
+CommandTable::~CommandTable()
+{
+	for (int i = 0; i < 256; i++) delete[] _bySource[i];
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Registers a handler for one command, from one source or ANY_SOURCE
+ * --A source's row is allocated the first time it gets a handler
+ * --Returns FALSE if src is out of range, the lengths are backwards or the
+ *   row couldn't be allocated
+ *
+ * Function params:
+ * src:			Source address, or ANY_SOURCE
+ * cmd:			Command to handle
+ * handler:		Function called with the packet
+ * minLength:	Fewest payload bytes the handler accepts
+ * maxLength:	Most payload bytes the handler accepts
+ *
+ */
+bool CommandTable::add(int src, uint8_t cmd, CommandHandlerFunction handler,
+                       uint8_t minLength, uint8_t maxLength)
+{
+	return addRange(src, cmd, cmd, handler, minLength, maxLength);
+}
+
+bool CommandTable::addRange(int src, uint8_t firstCmd, uint8_t lastCmd,
+                            CommandHandlerFunction handler,
+                            uint8_t minLength, uint8_t maxLength)
+{
+	command_entry_t * row;
+
+	if (src < ANY_SOURCE || src > 255 || firstCmd > lastCmd || minLength > maxLength)
+	{
+		return false;
+	}
+	if (src == ANY_SOURCE) row = _anySource;
+	else
+	{
+		if (!_bySource[src]) _bySource[src] = new (std::nothrow) command_entry_t[256]();
+		if (!_bySource[src]) return false;
+		row = _bySource[src];
+	}
+
+	for (int cmd = firstCmd; cmd <= lastCmd; cmd++)
+	{
+		row[cmd].handler = handler;
+		row[cmd].minLength = minLength;
+		row[cmd].maxLength = maxLength;
+	}
+	return true;
+}
+
+void CommandTable::setDefault(CommandHandlerFunction handler)
+{
+	_default.handler = handler;
+}
+
+/* Function flow:
+ * --Looks in the source's own row, then in the any-source row, then falls
+ *   back to the default handler
+ *
+ */
+const command_entry_t * CommandTable::find(uint8_t src, uint8_t cmd) const
+{
+	const command_entry_t * row = _bySource[src];
+
+	if (row && row[cmd].handler) return &row[cmd];
+	if (_anySource[cmd].handler) return &_anySource[cmd];
+	return &_default;
+}
+
+/* Function flow:
+ * --Finds the packet's handler and checks the payload length against it
+ *   before anything reads the payload
+ * --Then runs the handler
+ *
+ * Function params:
+ * packet:		The received packet
+ *
+ */
+int CommandTable::dispatch(const PacketView & packet) const
+{
+	const command_entry_t * entry = find(packet.src(), packet.cmd());
+
+	if (!entry->handler) return EBADCOMMAND;
+	if (packet.len() < entry->minLength || packet.len() > entry->maxLength) return EBADLEN;
+
+	entry->handler(packet);
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * CommandTable.h
+ *
+ * Declares the table the host dispatches received packets through. Handlers
+ * are registered at startup per (source, command), or per command for any
+ * source, together with the payload length they expect. A packet then finds
+ * its handler with two array lookups, and a packet of the wrong length is
+ * rejected (EBADLEN) before its handler decodes anything.
+ *
+ */
+
+#ifndef CommandTable_h
+#define CommandTable_h
+
+#include "Packet.h"
+
+/* Pass as the source to register a handler for every source */
+#define ANY_SOURCE -1
+
+/* typedef for On-command-received function */
+typedef void (*CommandHandlerFunction)(const PacketView & packet);
+
+/* One table slot: its handler and the payload lengths it accepts */
+typedef struct command_entry_t
+{
+	CommandHandlerFunction handler;
+	uint8_t minLength;
+	uint8_t maxLength;
+} command_entry_t;
+
+class CommandTable
+{
+public:
+CommandTable();
+~CommandTable();
+
+/* Registration. A (source, command) handler wins over an ANY_SOURCE one for
+ * the same command. Lengths are payload bytes (len()), both inclusive */
+bool add(int src, uint8_t cmd, CommandHandlerFunction handler,
+         uint8_t minLength = 0, uint8_t maxLength = 255);
+bool addRange(int src, uint8_t firstCmd, uint8_t lastCmd,
+              CommandHandlerFunction handler,
+              uint8_t minLength = 0, uint8_t maxLength = 255);
+
+/* Runs for commands nobody registered; takes any length */
+void setDefault(CommandHandlerFunction handler);
+
+/* The slot a packet from src with cmd dispatches to */
+const command_entry_t * find(uint8_t src, uint8_t cmd) const;
+
+/* Returns 0 once the handler ran, EBADLEN if packet.len() is out of the
+ * handler's range, EBADCOMMAND if there is no handler at all */
+int dispatch(const PacketView & packet) const;
+
+private:
+/* Per-source rows are only allocated for sources that register something */
+command_entry_t * _bySource[256];
+command_entry_t _anySource[256];
+command_entry_t _default;
+};
+
+#endif // CommandTable_h
@@ -0,0 +1,118 @@
+/*
+ * DeviceRegistry.cpp
+ *
+ * Defines the DeviceRegistry class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "DeviceRegistry.h"
+
+#include <chrono>
+
+/* A counter only its one writer changes: no locked read-modify-write needed */
+static inline void bump(std::atomic<uint64_t> & counter, uint64_t by = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+/*****************************************************************************
+ * Contructor
+ ****************************************************************************/
+DeviceRegistry::DeviceRegistry()
+	: _count(0)
+{
+	reset();
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Counts a good packet against the device it came from
+ * --The first one also stamps firstSeen and adds the device to count()
+ * --Returns TRUE if the device had not been seen before
+ *
+ * Function params:
+ * address:		The packet's source
+ * size:		Size of the packet, header to trailer
+ * now:			Steady clock time it was received, see now()
+ *
+ */
+bool DeviceRegistry::recordPacket(uint8_t address, size_t size, uint64_t now)
+{
+	device_slot_t & device = _devices[address];
+	bool first = device.packets.load(std::memory_order_relaxed) == 0;
+
+	if (first)
+	{
+		device.firstSeen.store(now, std::memory_order_relaxed);
+		_count.store(_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	device.lastSeen.store(now, std::memory_order_relaxed);
+	bump(device.bytes, size);
+	bump(device.packets);
+	return first;
+}
+
+/* Function flow:
+ * --Counts a packet that failed its integrity check against the source its
+ *   header names. The header wasn't checked either, so this is a hint of
+ *   which link is noisy rather than proof
+ *
+ */
+void DeviceRegistry::recordChecksumFailure(uint8_t address)
+{
+	bump(_devices[address].checksumFailures);
+}
+
+void DeviceRegistry::recordError(uint8_t address)
+{
+	bump(_devices[address].errors);
+}
+
+/* Function flow:
+ * --Forgets every device and zeroes every counter
+ */
+void DeviceRegistry::reset()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		device_slot_t & device = _devices[i];
+		device.firstSeen.store(0, std::memory_order_relaxed);
+		device.lastSeen.store(0, std::memory_order_relaxed);
+		device.packets.store(0, std::memory_order_relaxed);
+		device.bytes.store(0, std::memory_order_relaxed);
+		device.checksumFailures.store(0, std::memory_order_relaxed);
+		device.errors.store(0, std::memory_order_relaxed);
+	}
+	_count.store(0, std::memory_order_relaxed);
+}
+
+bool DeviceRegistry::known(uint8_t address) const
+{
+	return _devices[address].packets.load(std::memory_order_relaxed) != 0;
+}
+
+device_stats_t DeviceRegistry::stats(uint8_t address) const
+{
+	const device_slot_t & device = _devices[address];
+	device_stats_t stats;
+
+	stats.firstSeen = device.firstSeen.load(std::memory_order_relaxed);
+	stats.lastSeen = device.lastSeen.load(std::memory_order_relaxed);
+	stats.packets = device.packets.load(std::memory_order_relaxed);
+	stats.bytes = device.bytes.load(std::memory_order_relaxed);
+	stats.checksumFailures = device.checksumFailures.load(std::memory_order_relaxed);
+	stats.errors = device.errors.load(std::memory_order_relaxed);
+	return stats;
+}
+
+uint64_t DeviceRegistry::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
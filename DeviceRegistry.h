@@ -0,0 +1,71 @@
+/*
+ * DeviceRegistry.h
+ *
+ * Declares the registry of the devices packets have arrived from. Each of
+ * the 256 addresses has its own slot, so looking a device up or counting a
+ * packet against it is one array index, whatever the number of devices.
+ *
+ * One thread records (the one handling packets); any thread can read the
+ * counters at the same time without a lock. Every counter is a relaxed
+ * atomic with a single writer, so recording is a plain load + store, and a
+ * reader sees each counter whole, though not all of a device's counters
+ * from the same instant.
+ *
+ */
+
+#ifndef DeviceRegistry_h
+#define DeviceRegistry_h
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A device's counters, copied out of the registry at one go */
+typedef struct device_stats_t
+{
+	uint64_t firstSeen;			// steady clock ns of its first good packet, 0 = never
+	uint64_t lastSeen;			// steady clock ns of its latest good packet
+	uint64_t packets;			// Good packets received
+	uint64_t bytes;				// Bytes of those packets, header to trailer
+	uint64_t checksumFailures;	// Packets whose trailer didn't match
+	uint64_t errors;			// eError packets it sent
+} device_stats_t;
+
+class DeviceRegistry
+{
+public:
+DeviceRegistry();
+
+/* Writer side: only the thread handling packets calls these.
+ * recordPacket returns TRUE the first time the device is seen */
+bool recordPacket(uint8_t address, size_t size, uint64_t now);
+void recordChecksumFailure(uint8_t address);
+void recordError(uint8_t address);
+void reset();
+
+/* Safe to call from any thread */
+bool known(uint8_t address) const;
+size_t count() const { return _count.load(std::memory_order_relaxed); }
+device_stats_t stats(uint8_t address) const;
+
+/* Steady clock in ns, for recordPacket's 'now' */
+static uint64_t now();
+
+private:
+/* One cache line per device, so a reader polling one device never slows
+ * the writer updating another */
+struct alignas(64) device_slot_t
+{
+	std::atomic<uint64_t> firstSeen;
+	std::atomic<uint64_t> lastSeen;
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> checksumFailures;
+	std::atomic<uint64_t> errors;
+};
+
+device_slot_t _devices[256];
+std::atomic<size_t> _count;
+};
+
+#endif // DeviceRegistry_h
@@ -0,0 +1,92 @@
+/*
+ * Packet.h
+ *
+ * Declares PacketView and PacketBuilder: non-owning handles on a packet in
+ * someone else's buffer (a port's decode buffer, a FrameRing slot, a pool),
+ * with typed access to its header and body. Nothing is copied, so any number
+ * of packets can be handled at once, on any thread, from any port.
+ *
+ * Both are a pointer and a size; pass them by value or reference freely, but
+ * only while the buffer underneath is still alive.
+ *
+ */
+
+#ifndef Packet_h
+#define Packet_h
+
+#include "iProtocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A received packet, header first, trailer included */
+class PacketView
+{
+public:
+PacketView(const uint8_t * packet, size_t size) : _p(packet), _size(size) {}
+
+const uint8_t * data() const { return _p; }
+size_t size() const { return _size; }
+
+/* Header */
+const housekeeping_hdr_t * header() const { return (const housekeeping_hdr_t *) _p; }
+uint8_t dst() const { return header()->dst; }
+uint8_t src() const { return header()->src; }
+uint8_t cmd() const { return header()->cmd; }
+uint8_t len() const { return header()->len; }
+
+/* The len() bytes after the header */
+const uint8_t * payload() const { return _p + sizeof(housekeeping_hdr_t); }
+
+/* Bodies of the commands that carry a struct (eError, eSetPriority). Only
+ * meaningful once len() has been checked against the struct's size */
+const housekeeping_err_t * error() const { return (const housekeeping_err_t *) payload(); }
+const housekeeping_prio_t * priority() const { return (const housekeeping_prio_t *) payload(); }
+
+private:
+const uint8_t * _p;
+size_t _size;
+};
+
+/* A packet being put together in a buffer of at least 'capacity' bytes */
+class PacketBuilder
+{
+public:
+PacketBuilder(uint8_t * packet, size_t capacity) : _p(packet), _capacity(capacity) {}
+
+uint8_t * data() const { return _p; }
+size_t capacity() const { return _capacity; }
+
+/* Header */
+housekeeping_hdr_t * header() const { return (housekeeping_hdr_t *) _p; }
+void setHeader(uint8_t src, uint8_t dst, uint8_t cmd, uint8_t len) const
+{
+	header()->src = src;
+	header()->dst = dst;
+	header()->cmd = cmd;
+	header()->len = len;
+}
+
+/* Where the payload goes, and the struct bodies laid over it */
+uint8_t * payload() const { return _p + sizeof(housekeeping_hdr_t); }
+housekeeping_err_t * error() const { return (housekeeping_err_t *) payload(); }
+housekeeping_prio_t * priority() const { return (housekeeping_prio_t *) payload(); }
+
+/* Header + payload + trailer in the destination's integrity mode */
+size_t size() const
+{
+	return sizeof(housekeeping_hdr_t) + header()->len + trailerSize(getIntegrity(header()->dst));
+}
+
+/* Fills in the trailer for the destination; returns the size to send */
+size_t finish() const { return fillTrailer(_p, getIntegrity(header()->dst)); }
+
+/* The packet as it would be received */
+PacketView view() const { return PacketView(_p, size()); }
+
+private:
+uint8_t * _p;
+size_t _capacity;
+};
+
+#endif // Packet_h
@@ -0,0 +1,151 @@
+/*
+ * PayloadSchema.h
+ *
+ * Declares payload schemas: compile-time descriptions of where each value
+ * sits in a command's payload, and decoders generated from them. A schema
+ * lists its fields, each with its type, byte offset and byte order:
+ *
+ *	typedef Schema<Field<double, 0>, Field<double, 8>, Field<char, 16>> pressure_payload_t;
+ *	auto [pressure, temperature, type] = pressure_payload_t::decode(payload, len);
+ *
+ * decode() reads every field straight out of the packet buffer into its
+ * typed value; no temporary copy of the payload is made. encode() is the
+ * other way around, for whoever sends the payload. Schema::size is
+ * the fewest payload bytes the layout needs, for registering the command
+ * (see CommandTable.h).
+ *
+ */
+
+#ifndef PayloadSchema_h
+#define PayloadSchema_h
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/* Byte order of a field on the wire. The LaunchPads send theirs LSB first */
+typedef enum byte_order
+{
+	eLittleEndian = 0,
+	eBigEndian = 1
+} byte_order_t;
+
+/* Unsigned integer as wide as a field, to assemble its bytes in */
+template <size_t Size> struct field_bits;
+template <> struct field_bits<1> { typedef uint8_t type; };
+template <> struct field_bits<2> { typedef uint16_t type; };
+template <> struct field_bits<4> { typedef uint32_t type; };
+template <> struct field_bits<8> { typedef uint64_t type; };
+
+/* A number (integer, float, double, char) at a fixed offset */
+template <typename T, size_t Offset, byte_order_t Order = eLittleEndian>
+struct Field
+{
+	static_assert(std::is_arithmetic<T>::value, "Field holds one number");
+
+	typedef T value_type;
+	static constexpr size_t end = Offset + sizeof(T);
+
+	/* The bytes are put together by shifting, so the result doesn't depend
+	 * on the host's byte order; the compiler turns it into one load (plus a
+	 * byte swap for the other order) */
+	static T read(const uint8_t * payload, size_t len)
+	{
+		typedef typename field_bits<sizeof(T)>::type bits_t;
+		bits_t bits = 0;
+		T value;
+
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			size_t at = Order == eLittleEndian ? i : sizeof(T) - 1 - i;
+			bits |= (bits_t) payload[Offset + at] << (8 * i);
+		}
+		memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	/* Returns the end of the field */
+	static size_t write(uint8_t * payload, T value)
+	{
+		typedef typename field_bits<sizeof(T)>::type bits_t;
+		bits_t bits;
+
+		memcpy(&bits, &value, sizeof(T));
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			size_t at = Order == eLittleEndian ? i : sizeof(T) - 1 - i;
+			payload[Offset + at] = (uint8_t)(bits >> (8 * i));
+		}
+		return end;
+	}
+};
+
+/* Characters from Offset up to the first NUL, at most MaxLength of them,
+ * and never past the end of the payload. Can be empty, so it adds nothing
+ * to the schema's size beyond its offset */
+template <size_t Offset, size_t MaxLength>
+struct Text
+{
+	typedef std::string_view value_type;
+	static constexpr size_t end = Offset;
+
+	static std::string_view read(const uint8_t * payload, size_t len)
+	{
+		size_t room = len > Offset ? std::min(len - Offset, MaxLength) : 0;
+		const char * text = (const char *) payload + Offset;
+		return std::string_view(text, strnlen(text, room));
+	}
+
+	/* Writes the text and its NUL, cut to MaxLength - 1 characters.
+	 * Returns the end of the NUL */
+	static size_t write(uint8_t * payload, std::string_view text)
+	{
+		size_t n = std::min(text.size(), MaxLength - 1);
+		memcpy(payload + Offset, text.data(), n);
+		payload[Offset + n] = 0;
+		return Offset + n + 1;
+	}
+};
+
+/* A payload layout: a list of fields */
+template <typename... Fields>
+struct Schema
+{
+	static_assert(sizeof...(Fields) > 0, "Schema needs a field");
+
+	/* One decoded sample: every field's value, in the order listed */
+	typedef std::tuple<typename Fields::value_type...> sample_t;
+
+	/* Fewest payload bytes that hold every field */
+	static constexpr size_t size = std::max({ Fields::end... });
+
+	static constexpr bool fits(size_t len) { return len >= size; }
+
+	/* The payload must fit the schema (see fits()) */
+	static sample_t decode(const uint8_t * payload, size_t len)
+	{
+		return sample_t(Fields::read(payload, len)...);
+	}
+
+	/* Writes a sample; the payload must have room for it. Returns the
+	 * payload length it takes up */
+	static size_t encode(uint8_t * payload, const sample_t & sample)
+	{
+		return encodeFields(payload, sample, std::index_sequence_for<Fields...>());
+	}
+
+private:
+	template <size_t... I>
+	static size_t encodeFields(uint8_t * payload, const sample_t & sample,
+	                           std::index_sequence<I...>)
+	{
+		return std::max({ Fields::write(payload, std::get<I>(sample))... });
+	}
+};
+
+#endif // PayloadSchema_h
@@ -0,0 +1,204 @@
+/*
+ * PollScheduler.cpp
+ *
+ * Defines the PollScheduler class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "PollScheduler.h"
+
+#include <math.h>
+#include <new>
+
+/* define POLL_TICK_NS for POLL_TICK in the ns run() is given */
+#define POLL_TICK_NS ((uint64_t)(POLL_TICK * 1e9))
+/* define POLL_MAX_PERIOD for the slowest rate's period, in seconds: well
+ * inside the wheel's range, jitter included */
+#define POLL_MAX_PERIOD (0.5 * WHEEL_RANGE * POLL_TICK)
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+PollScheduler::PollScheduler(size_t capacity)
+	: _capacity(0), _numPolls(0), _wheel(capacity, &pollExpired, this),
+	  _start(0), _now(0), _jitter(POLL_JITTER), _random(88172645463325252ull),
+	  SendFunction(0), _context(0)
+{
+	_polls = new (std::nothrow) poll_entry_t[capacity];
+	if (_polls && _wheel.capacity() == capacity) _capacity = capacity;
+}
+
+PollScheduler::~PollScheduler()
+{
+	delete[] _polls;
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+void PollScheduler::setSendFunction(PollSendFunction SendFunction, void * context)
+{
+	this->SendFunction = SendFunction;
+	_context = context;
+}
+
+/* Jitter is clamped to 0..0.5 of a period, so sends stay in order */
+void PollScheduler::setJitter(double fraction)
+{
+	_jitter = fraction < 0 ? 0 : fraction > 0.5 ? 0.5 : fraction;
+}
+
+/* Function flow:
+ * --Adds a request to the list. It isn't sent until start()
+ * --Returns its index, or -1 if the list is full or the rate is faster than
+ *   the scheduler's tick or slower than the wheel reaches
+ *
+ * Function params:
+ * dst:			Device to send the request to
+ * cmd:			Command to send it
+ * rate:		Sends per second
+ *
+ */
+int PollScheduler::add(uint8_t dst, uint8_t cmd, double rate)
+{
+	if (_numPolls >= _capacity || !(rate > 0) || rate > 1 / POLL_TICK ||
+	    1 / rate > POLL_MAX_PERIOD)
+	{
+		return -1;
+	}
+
+	poll_entry_t & poll = _polls[_numPolls];
+	poll.dst = dst;
+	poll.cmd = cmd;
+	poll.rate = rate;
+	poll.period = (uint64_t)(1e9 / rate);
+	poll.nominal = poll.planned = 0;
+	poll.sent = poll.failed = poll.missed = 0;
+	poll.slipTotal = poll.slipMax = 0;
+	return _numPolls++;
+}
+
+/* Function flow:
+ * --Makes now the wheel's tick 0
+ * --Starts each request at its own phase of its period: the fractional
+ *   part of index * golden ratio, which spreads any number of requests
+ *   evenly, however many are added
+ *
+ */
+void PollScheduler::start(uint64_t now)
+{
+	_start = now;
+	_now = now;
+	for (size_t i = 0; i < _numPolls; i++)
+	{
+		double phase = fmod(i * 0.6180339887498949, 1.0);
+		_polls[i].nominal = now + (uint64_t)(phase * _polls[i].period);
+		plan(i);
+	}
+}
+
+/* Function flow:
+ * --Sends every request due by 'now' (see send())
+ * --Returns the seconds until the wheel has work again, 0 if it never will
+ *
+ * Function params:
+ * now:			Steady clock, ns (see DeviceRegistry::now())
+ *
+ */
+double PollScheduler::run(uint64_t now)
+{
+	_now = now;
+	_wheel.advance((now - _start) / POLL_TICK_NS);
+
+	uint64_t next = _wheel.nextExpiry();
+	if (next == WHEEL_NEVER) return 0;
+
+	uint64_t at = _start + next * POLL_TICK_NS;
+	return at > now ? (at - now) / 1e9 : 1e-9;
+}
+
+void PollScheduler::pollExpired(void * context, int timer, uint64_t due)
+{
+	((PollScheduler *) context)->send(timer);
+}
+
+/* Function flow:
+ * --Sends the request and counts how late it went out (slip)
+ * --Moves on to the next period. Periods that have already gone by are
+ *   counted as missed rather than sent now, so a stall (e.g. a blocked main
+ *   loop) isn't followed by a burst of catching up
+ *
+ */
+void PollScheduler::send(int index)
+{
+	poll_entry_t & poll = _polls[index];
+	uint64_t slip = _now > poll.planned ? _now - poll.planned : 0;
+
+	poll.slipTotal += slip;
+	if (slip > poll.slipMax) poll.slipMax = slip;
+
+	if (SendFunction && SendFunction(_context, poll.dst, poll.cmd)) poll.sent++;
+	else poll.failed++;
+
+	poll.nominal += poll.period;
+	if (poll.nominal <= _now)
+	{
+		uint64_t behind = (_now - poll.nominal) / poll.period + 1;
+		poll.missed += behind;
+		poll.nominal += behind * poll.period;
+	}
+	plan(index);
+}
+
+/* Function flow:
+ * --Plans the send of the current period: its nominal time plus a random
+ *   +-jitter of the period, never before now
+ * --Sets its timer for the first tick at or after that
+ *
+ */
+void PollScheduler::plan(int index)
+{
+	poll_entry_t & poll = _polls[index];
+
+	_random ^= _random << 13;
+	_random ^= _random >> 7;
+	_random ^= _random << 17;
+	double offset = ((_random >> 11) * (2.0 / 9007199254740992.0) - 1) * _jitter * poll.period;
+
+	int64_t planned = (int64_t) poll.nominal + (int64_t) offset;
+	poll.planned = planned > (int64_t) _now ? planned : _now;
+	_wheel.schedule(index, (poll.planned - _start + POLL_TICK_NS - 1) / POLL_TICK_NS);
+}
+
+size_t PollScheduler::numPolls() const
+{
+	return _numPolls;
+}
+
+const poll_entry_t & PollScheduler::poll(int index) const
+{
+	return _polls[index];
+}
+
+/* Function flow:
+ * --Prints each request's rate, how many went out, how many couldn't and
+ *   how many periods were missed, and its mean + worst slip
+ *
+ */
+void PollScheduler::report(FILE * out) const
+{
+	for (size_t i = 0; i < _numPolls; i++)
+	{
+		const poll_entry_t & poll = _polls[i];
+		uint64_t made = poll.sent + poll.failed;
+
+		fprintf(out, "Poll of device #%d command #%d at %g Hz: %llu sent, %llu failed, "
+		        "%llu missed, slip %.3f ms mean, %.3f ms worst\n",
+		        poll.dst, poll.cmd, poll.rate, (unsigned long long) poll.sent,
+		        (unsigned long long) poll.failed, (unsigned long long) poll.missed,
+		        made ? poll.slipTotal / 1e6 / made : 0.0, poll.slipMax / 1e6);
+	}
+}
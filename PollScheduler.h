@@ -0,0 +1,103 @@
+/*
+ * PollScheduler.h
+ *
+ * Declares the poll scheduler: sends requests (a command to a device, e.g.
+ * eSendHiPriority to the magnet board) over and over at a rate set for
+ * each, for as many devices and commands as are added. The requests are
+ * timers on a TimerWheel with 1 ms ticks.
+ *
+ * Requests don't go out in bursts:
+ * --Each one starts at its own phase of its period (the golden ratio of its
+ *   index), so ten 10 Hz polls go out spread over the 100 ms, not all at once
+ * --Each send is moved by up to +-jitter of the period at random, so polls
+ *   of different rates don't keep lining up. The jitter doesn't add up: the
+ *   next send is planned from where this one was due, not from when it was
+ *   sent
+ *
+ * The scheduler reports slip: how late each send was against the time it
+ * was planned for. A request that falls a whole period or more behind goes
+ * out once, and the periods it fell behind are counted as missed instead of
+ * being made up in a burst.
+ *
+ * The owner calls run() with the time whenever it wakes up, and sleeps for
+ * as long as run() returns (see pollTimedOut() in main.cpp).
+ *
+ */
+
+#ifndef PollScheduler_h
+#define PollScheduler_h
+
+#include "TimerWheel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* define POLL_TICK for the scheduler's clock: seconds per tick */
+#define POLL_TICK 0.001
+/* define POLL_JITTER for the default jitter: fraction of a period */
+#define POLL_JITTER 0.05
+
+/* typedef for Send-the-request function. Returns FALSE if it couldn't */
+typedef bool (*PollSendFunction)(void * context, uint8_t dst, uint8_t cmd);
+
+/* One request the scheduler keeps sending, and how that is going */
+typedef struct poll_entry_t
+{
+	uint8_t dst;
+	uint8_t cmd;
+	double rate;			// Hz
+	uint64_t period;		// ns
+	uint64_t nominal;		// ns, where the current period starts
+	uint64_t planned;		// ns, nominal + this period's jitter
+	uint64_t sent;
+	uint64_t failed;		// The send function returned FALSE
+	uint64_t missed;		// Periods skipped for being a whole period late
+	uint64_t slipTotal;		// ns
+	uint64_t slipMax;		// ns
+} poll_entry_t;
+
+class PollScheduler
+{
+public:
+PollScheduler(size_t capacity);
+~PollScheduler();
+
+void setSendFunction(PollSendFunction SendFunction, void * context);
+void setJitter(double fraction);
+
+/* Adds a request sent 'rate' times a second. Returns its index, or -1 if
+ * the scheduler is full or the rate out of range */
+int add(uint8_t dst, uint8_t cmd, double rate);
+
+/* Plans every request's first send from 'now' (ns, steady clock) */
+void start(uint64_t now);
+
+/* Sends every request due by 'now'. Returns seconds until the next one is
+ * due, or 0 if nothing is scheduled */
+double run(uint64_t now);
+
+size_t numPolls() const;
+const poll_entry_t & poll(int index) const;
+
+/* Prints one line per request: rate, sent, slip, missed */
+void report(FILE * out) const;
+
+private:
+static void pollExpired(void * context, int timer, uint64_t due);
+void send(int index);
+void plan(int index);
+
+poll_entry_t * _polls;
+size_t _capacity;
+size_t _numPolls;
+TimerWheel _wheel;
+uint64_t _start;		// ns at tick 0
+uint64_t _now;			// ns, of the current run()
+double _jitter;
+uint64_t _random;		// xorshift state for the jitter
+
+PollSendFunction SendFunction;
+void * _context;
+};
+
+#endif // PollScheduler_h
@@ -0,0 +1,521 @@
+/*
+ * RequestTracker.cpp
+ *
+ * Defines the RequestTracker class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "RequestTracker.h"
+#include "iProtocol.h"
+
+#include <new>
+#include <string.h>
+
+/* define REQUEST_TICK_NS for REQUEST_TICK in the ns the tracker is given */
+#define REQUEST_TICK_NS ((uint64_t)(REQUEST_TICK * 1e9))
+/* define the RTO range in ns */
+#define MIN_RTO_NS ((uint64_t)(REQUEST_MIN_RTO * 1e9))
+#define MAX_RTO_NS ((uint64_t)(REQUEST_MAX_RTO * 1e9))
+
+/* Histogram bucket of a round-trip time: 4 buckets per power of 2 */
+static int bucketOf(uint64_t ns)
+{
+	if (ns < 4) return (int) ns;
+	int msb = 63 - __builtin_clzll(ns);
+	return msb * 4 + (int)((ns >> (msb - 2)) & 3);
+}
+
+/* Middle of a bucket, ns */
+static uint64_t bucketMiddle(int bucket)
+{
+	if (bucket < 4) return bucket;
+	int msb = bucket / 4;
+	uint64_t low = (uint64_t)(4 + bucket % 4) << (msb - 2);
+	return low + (1ull << (msb - 2)) / 2;
+}
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+RequestTracker::RequestTracker(size_t capacity)
+	: _capacity(0), _window(0), _deviceWindow(0), _inFlight(0), _free(-1),
+	  _deadlines(capacity, &deadlineExpired, this),
+	  _timeout((uint64_t)(REQUEST_TIMEOUT * 1e9)), _retries(REQUEST_RETRIES),
+	  _start(0), _now(0), _started(false),
+	  RequestDoneFunction(0), _context(0), SendFunction(0), _sendContext(0)
+{
+	_requests = new (std::nothrow) request_t[capacity];
+	if (_requests && _deadlines.capacity() == capacity) _capacity = capacity;
+	_window = _capacity;
+	_deviceWindow = _capacity;
+
+	/* Every request starts out on the free list */
+	for (size_t i = _capacity; i-- > 0; )
+	{
+		_requests[i].next = _free;
+		_free = i;
+	}
+	memset(_oldest, 0xFF, sizeof(_oldest));
+	memset(_newest, 0xFF, sizeof(_newest));
+	memset(_open, 0, sizeof(_open));
+	memset(&_stats, 0, sizeof(_stats));
+	memset(_rtt, 0, sizeof(_rtt));
+	memset(_owed, 0, sizeof(_owed));
+	memset(_losses, 0, sizeof(_losses));
+}
+
+RequestTracker::~RequestTracker()
+{
+	delete[] _requests;
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Returns FALSE if window is 0 or more than the capacity. A smaller window
+ * than inFlight() lets the open requests finish, just holds back new ones */
+bool RequestTracker::setWindow(size_t window)
+{
+	if (window == 0 || window > _capacity) return false;
+	_window = window;
+	return true;
+}
+
+size_t RequestTracker::window() const
+{
+	return _window;
+}
+
+/* Returns FALSE if window is 0 or more than the capacity. A device that
+ * hasn't answered yet gets one request at a time all the same */
+bool RequestTracker::setDeviceWindow(size_t window)
+{
+	if (window == 0 || window > _capacity) return false;
+	_deviceWindow = window;
+	return true;
+}
+
+size_t RequestTracker::deviceWindow() const
+{
+	return _deviceWindow;
+}
+
+/* Deadline of requests to a device that hasn't answered yet, sent from
+ * now on. Clamped to the RTO range */
+void RequestTracker::setTimeout(double seconds)
+{
+	if (seconds < REQUEST_MIN_RTO) seconds = REQUEST_MIN_RTO;
+	if (seconds > REQUEST_MAX_RTO) seconds = REQUEST_MAX_RTO;
+	_timeout = (uint64_t)(seconds * 1e9);
+}
+
+double RequestTracker::timeout() const
+{
+	return _timeout / 1e9;
+}
+
+/* Sends after the first, before a request is given up on */
+void RequestTracker::setRetries(int retries)
+{
+	_retries = retries < 0 ? 0 : retries > 254 ? 254 : retries;
+}
+
+int RequestTracker::retries() const
+{
+	return _retries;
+}
+
+void RequestTracker::setDoneFunction(RequestHandlerFunction RequestDoneFunction, void * context)
+{
+	this->RequestDoneFunction = RequestDoneFunction;
+	_context = context;
+}
+
+/* Without one, requests are given up on at their first deadline */
+void RequestTracker::setSendFunction(RequestSendFunction SendFunction, void * context)
+{
+	this->SendFunction = SendFunction;
+	_sendContext = context;
+}
+
+bool RequestTracker::canSend() const
+{
+	return _inFlight < _window;
+}
+
+/* Whether a request to dst may go out: room in the window, and in dst's */
+bool RequestTracker::canSend(uint8_t dst) const
+{
+	return canSend() && _open[dst] < (_rtt[dst].samples ? _deviceWindow : 1);
+}
+
+/* Function flow:
+ * --Takes a free request, keeps a copy of the packet for resending, and
+ *   puts it last in its device's list
+ * --Sets its deadline one RTO of its device from now
+ * --Returns its index, or -1 for a broadcast, a packet too short or too
+ *   long, or when the window or its device's is full
+ *
+ * Function params:
+ * packet:		The packet sent, header to trailer
+ * size:		Its size
+ * now:			Steady clock, ns (see DeviceRegistry::now())
+ *
+ */
+int RequestTracker::sent(const uint8_t * packet, size_t size, uint64_t now)
+{
+	if (size < sizeof(housekeeping_hdr_t) || size > REQUEST_MAX_PACKET) return -1;
+
+	PacketView view(packet, size);
+	uint8_t dst = view.dst();
+
+	if (dst == eBroadcast || !canSend(dst) || _free < 0) return -1;
+	if (!_started)
+	{
+		_start = now;
+		_started = true;
+	}
+	if (now > _now) _now = now;
+
+	int index = _free;
+	request_t & request = _requests[index];
+	_free = request.next;
+
+	request.dst = dst;
+	request.cmd = view.cmd();
+	request.tries = 1;
+	request.sentAt = request.lastSentAt = now;
+	request.rtt = 0;
+	request.losses = _losses[dst][request.cmd];
+	request.size = size;
+	memcpy(request.packet, packet, size);
+	request.next = -1;
+	request.prev = _newest[dst];
+	if (request.prev >= 0) _requests[request.prev].next = index;
+	else _oldest[dst] = index;
+	_newest[dst] = index;
+
+	setDeadline(index);
+	_inFlight++;
+	_open[dst]++;
+	_stats.sent++;
+	return index;
+}
+
+/* Deadline: one RTO of the request's device after it was last sent */
+void RequestTracker::setDeadline(int index)
+{
+	request_t & request = _requests[index];
+	uint64_t rto = _rtt[request.dst].rto ? _rtt[request.dst].rto : _timeout;
+
+	request.deadline = request.lastSentAt + rto;
+	_deadlines.schedule(index, (request.deadline - _start + REQUEST_TICK_NS - 1) / REQUEST_TICK_NS);
+}
+
+/* The oldest request open to dst with cmd, or -1 */
+int RequestTracker::find(uint8_t dst, uint8_t cmd) const
+{
+	return find(dst, cmd, _oldest[dst]);
+}
+
+/* Same, starting from the request at 'from' of dst's list */
+int RequestTracker::find(uint8_t dst, uint8_t cmd, int from) const
+{
+	for (int index = from; index >= 0; index = _requests[index].next)
+	{
+		if (_requests[index].cmd == cmd) return index;
+	}
+	return -1;
+}
+
+/* Function flow:
+ * --Finds the request the packet answers: by its source and command, or
+ *   for an eError, by the destination and command the error names
+ * --Closes it with its round-trip time, and updates its device's estimate
+ *   with it unless there's no telling which send the answer is to: the
+ *   request was sent more than once (Karn), or an older one with the same
+ *   command was resent or given up on since it was sent (boards answer in
+ *   order, so the answer may be that one's). Either way the device
+ *   answered, so any backoff ends
+ * --A lost answer goes unnoticed while the RTO is longer than the gap to
+ *   the next request with the same command (backoff, or no estimate yet),
+ *   and that request's answer then comes in as this one's, a gap late.
+ *   So while a later request with the same command is open, a round trip
+ *   longer than the estimate's RTO isn't measured either: taken, it would
+ *   stretch the RTO past the gap, and every later loss would go the same
+ *   way
+ * --Returns FALSE if no request was open for it, counting it late if one
+ *   was resent or given up on, unmatched otherwise
+ *
+ */
+bool RequestTracker::answered(const PacketView & packet, uint64_t now)
+{
+	request_status_t status = eRequestAnswered;
+	int index;
+
+	if (packet.cmd() == eError && packet.len() >= sizeof(housekeeping_err_t))
+	{
+		index = find(packet.error()->dst, packet.error()->cmd);
+		status = eRequestError;
+	}
+	else index = find(packet.src(), packet.cmd());
+
+	if (index < 0)
+	{
+		uint8_t dst = packet.src(), cmd = packet.cmd();
+		if (packet.cmd() == eError && packet.len() >= sizeof(housekeeping_err_t))
+		{
+			dst = packet.error()->dst;
+			cmd = packet.error()->cmd;
+		}
+
+		uint64_t bit = 1ull << (cmd & 63);
+		if (_owed[dst][cmd >> 6] & bit)
+		{
+			_owed[dst][cmd >> 6] &= ~bit;
+			_stats.late++;
+		}
+		else _stats.unmatched++;
+		return false;
+	}
+
+	request_t & request = _requests[index];
+	request.rtt = now > request.sentAt ? now - request.sentAt : 0;
+	uint64_t estimate = estimatedRto(request.dst);
+	if (request.tries == 1 && request.losses == _losses[request.dst][request.cmd] &&
+	    (!estimate || request.rtt <= estimate || find(request.dst, request.cmd, request.next) < 0))
+		sample(request.dst, request.rtt);
+	else endBackoff(request.dst);
+
+	if (_stats.answered + _stats.errors == 0 || request.rtt < _stats.rttMin) _stats.rttMin = request.rtt;
+	if (request.rtt > _stats.rttMax) _stats.rttMax = request.rtt;
+	_stats.rttTotal += request.rtt;
+	_stats.rttBuckets[bucketOf(request.rtt)]++;
+	if (status == eRequestAnswered) _stats.answered++;
+	else _stats.errors++;
+
+	_deadlines.cancel(index);
+	close(index, status);
+	return true;
+}
+
+/* Function flow:
+ * --Updates a device's SRTT and RTTVAR with one round-trip time, the first
+ *   setting them outright (RFC 6298 2.2, 2.3)
+ * --Sets its RTO from them (see endBackoff())
+ *
+ */
+void RequestTracker::sample(uint8_t dst, uint64_t rtt)
+{
+	device_rtt_t & device = _rtt[dst];
+
+	if (device.samples == 0)
+	{
+		device.srtt = rtt;
+		device.rttvar = rtt / 2;
+	}
+	else
+	{
+		uint64_t error = device.srtt > rtt ? device.srtt - rtt : rtt - device.srtt;
+		device.rttvar = (3 * device.rttvar + error) / 4;
+		device.srtt = (7 * device.srtt + rtt) / 8;
+	}
+	device.samples++;
+	endBackoff(dst);
+}
+
+/* Function flow:
+ * --Sets a device's RTO back to SRTT + max(tick, 4 * RTTVAR), clamped, or
+ *   back to timeout() if it has no estimate yet
+ *
+ */
+void RequestTracker::endBackoff(uint8_t dst)
+{
+	device_rtt_t & device = _rtt[dst];
+
+	device.backoffAt = 0;
+	device.rto = estimatedRto(dst);
+}
+
+/* A device's SRTT + max(tick, 4 * RTTVAR), clamped, or 0 if it has no
+ * estimate yet */
+uint64_t RequestTracker::estimatedRto(uint8_t dst) const
+{
+	const device_rtt_t & device = _rtt[dst];
+
+	if (device.samples == 0) return 0;
+
+	uint64_t variation = 4 * device.rttvar > REQUEST_TICK_NS ? 4 * device.rttvar : REQUEST_TICK_NS;
+	uint64_t rto = device.srtt + variation;
+	return rto < MIN_RTO_NS ? MIN_RTO_NS : rto > MAX_RTO_NS ? MAX_RTO_NS : rto;
+}
+
+/* Marks that an answer from dst to cmd may still come, after its request
+ * was resent or given up on, and counts the loss against the requests
+ * with that command still open */
+void RequestTracker::owe(uint8_t dst, uint8_t cmd)
+{
+	_owed[dst][cmd >> 6] |= 1ull << (cmd & 63);
+	_losses[dst][cmd]++;
+}
+
+/* Function flow:
+ * --Resends or closes every request whose deadline has passed
+ * --Returns the seconds until the next deadline, 0 if none are open
+ *
+ */
+double RequestTracker::run(uint64_t now)
+{
+	if (!_started) return 0;
+	if (now > _now) _now = now;
+	_deadlines.advance((now - _start) / REQUEST_TICK_NS);
+
+	uint64_t next = _deadlines.nextExpiry();
+	if (next == WHEEL_NEVER) return 0;
+
+	uint64_t at = _start + next * REQUEST_TICK_NS;
+	return at > now ? (at - now) / 1e9 : 1e-9;
+}
+
+void RequestTracker::deadlineExpired(void * context, int timer, uint64_t due)
+{
+	((RequestTracker *) context)->expired(timer);
+}
+
+/* Function flow:
+ * --A request's deadline passed without an answer: doubles its device's
+ *   RTO (RFC 6298 5.5), up to REQUEST_MAX_RTO. RFC 6298 has one timer per
+ *   connection, so it backs off once per expiry; here every open request
+ *   has its own, so a device backs off at most once per RTO, however many
+ *   of its requests expire together
+ * --Sends it again with a new deadline, if it has retries left and the
+ *   send function takes it
+ * --Otherwise closes it as timed out
+ *
+ */
+void RequestTracker::expired(int index)
+{
+	request_t & request = _requests[index];
+	device_rtt_t & device = _rtt[request.dst];
+	uint64_t rto = device.rto ? device.rto : _timeout;
+
+	if (!device.backoffAt || _now >= device.backoffAt + rto)
+	{
+		device.rto = 2 * rto < MAX_RTO_NS ? 2 * rto : MAX_RTO_NS;
+		device.backoffAt = _now;
+	}
+	owe(request.dst, request.cmd);
+
+	if (request.tries <= _retries && SendFunction &&
+	    SendFunction(_sendContext, request.packet, request.size))
+	{
+		request.tries++;
+		request.lastSentAt = _now;
+		_stats.retries++;
+		setDeadline(index);
+		return;
+	}
+
+	_stats.timedOut++;
+	close(index, eRequestTimedOut);
+}
+
+/* Function flow:
+ * --Takes the request out of its device's list and frees it, then hands a
+ *   copy to the done function, which may send the next request
+ *
+ */
+void RequestTracker::close(int index, request_status_t status)
+{
+	request_t & request = _requests[index];
+	request_t closed = request;
+
+	if (request.prev >= 0) _requests[request.prev].next = request.next;
+	else _oldest[request.dst] = request.next;
+	if (request.next >= 0) _requests[request.next].prev = request.prev;
+	else _newest[request.dst] = request.prev;
+
+	request.next = _free;
+	_free = index;
+	_inFlight--;
+	_open[request.dst]--;
+
+	if (RequestDoneFunction) RequestDoneFunction(_context, closed, status);
+}
+
+double RequestTracker::rto(uint8_t dst) const
+{
+	return (_rtt[dst].rto ? _rtt[dst].rto : _timeout) / 1e9;
+}
+
+const device_rtt_t & RequestTracker::deviceRtt(uint8_t dst) const
+{
+	return _rtt[dst];
+}
+
+size_t RequestTracker::inFlight() const
+{
+	return _inFlight;
+}
+
+const tracker_stats_t & RequestTracker::stats() const
+{
+	return _stats;
+}
+
+/* The middle of the histogram bucket the fraction falls in, kept within
+ * the smallest and largest round trips seen */
+uint64_t RequestTracker::percentile(double fraction) const
+{
+	uint64_t total = _stats.answered + _stats.errors;
+	uint64_t seen = 0;
+
+	if (total == 0) return 0;
+	for (int bucket = 0; bucket < RTT_BUCKETS; bucket++)
+	{
+		seen += _stats.rttBuckets[bucket];
+		if (seen < fraction * total || seen == 0) continue;
+
+		uint64_t rtt = bucketMiddle(bucket);
+		return rtt < _stats.rttMin ? _stats.rttMin : rtt > _stats.rttMax ? _stats.rttMax : rtt;
+	}
+	return _stats.rttMax;
+}
+
+/* Function flow:
+ * --Prints how many requests were sent, answered, failed, resent and timed
+ *   out, how many answers came late or matched nothing, and the round-trip
+ *   times
+ * --Prints the estimate of each device that has answered
+ *
+ */
+void RequestTracker::report(FILE * out) const
+{
+	uint64_t closed = _stats.answered + _stats.errors;
+
+	fprintf(out, "Requests: %llu sent, %llu answered, %llu errors, %llu timed out, "
+	        "%llu still open, %llu retries, %llu late answers, %llu unmatched answers "
+	        "(window %zu)\n",
+	        (unsigned long long) _stats.sent, (unsigned long long) _stats.answered,
+	        (unsigned long long) _stats.errors, (unsigned long long) _stats.timedOut,
+	        (unsigned long long) _inFlight, (unsigned long long) _stats.retries,
+	        (unsigned long long) _stats.late, (unsigned long long) _stats.unmatched, _window);
+	if (closed)
+	{
+		fprintf(out, "Round trip: %.3f ms min, %.3f ms mean, %.3f ms p50, %.3f ms p99, %.3f ms max\n",
+		        _stats.rttMin / 1e6, _stats.rttTotal / 1e6 / closed, percentile(0.5) / 1e6,
+		        percentile(0.99) / 1e6, _stats.rttMax / 1e6);
+	}
+	for (int dst = 0; dst < 256; dst++)
+	{
+		const device_rtt_t & device = _rtt[dst];
+		if (!device.rto) continue;
+		fprintf(out, "Device #%d: SRTT %.3f ms, RTTVAR %.3f ms, RTO %.3f ms (%llu samples)\n",
+		        dst, device.srtt / 1e6, device.rttvar / 1e6, device.rto / 1e6,
+		        (unsigned long long) device.samples);
+	}
+}
@@ -0,0 +1,209 @@
+/*
+ * RequestTracker.h
+ *
+ * Declares the request tracker: keeps the requests the host has sent and
+ * not yet had an answer to, so it can send the next one without waiting
+ * for the line to go quiet, and tell which answer belongs to which request.
+ *
+ * Packets carry no sequence number, so an answer is matched to the oldest
+ * request still open to the device it came from with the same command
+ * (boards answer in order). An eError answer is matched by the destination
+ * and command it reports instead, and closes its request as failed.
+ *
+ * At most window() requests are open at once, and at most deviceWindow()
+ * to any one device: only one until the device has answered a request,
+ * so a device that isn't there holds up none of the others. canSend()
+ * says whether another may go out. Each request has its own deadline, kept on a
+ * TimerWheel; run() handles the ones that expire. Every closed request goes
+ * to the done function with its round-trip time, and into the latency
+ * statistics report() prints.
+ *
+ * Deadlines adapt to each device, the way TCP's retransmission timer does
+ * (RFC 6298): every answer updates the device's smoothed round-trip time
+ * (SRTT) and its variation (RTTVAR), and its requests get
+ *	RTO = SRTT + max(tick, 4 * RTTVAR)
+ * clamped to REQUEST_MIN_RTO..REQUEST_MAX_RTO, or timeout() until it has
+ * answered once. A request past its deadline is sent again, up to
+ * retries() times, and the device's RTO doubles (backoff) until its next
+ * answer: at most once per RTO, however many of its requests expire
+ * together. Answers to a request sent more than once aren't
+ * measured, as there's no telling which send they answer (Karn), and nor
+ * are those to a request sent before an older one with the same command
+ * was resent or given up on: boards answer in order, so only a loss makes
+ * the oldest-first match ambiguous. A loss the RTO hasn't caught yet can
+ * too, so while a later request with the same command is open, round trips
+ * longer than the estimate's RTO aren't measured either.
+ * An answer that comes after its request was resent or given up on is
+ * counted as late.
+ *
+ * Broadcasts (eBroadcast) aren't tracked, as every board answers them.
+ *
+ */
+
+#ifndef RequestTracker_h
+#define RequestTracker_h
+
+#include "Packet.h"
+#include "TimerWheel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* define REQUEST_TICK for the deadlines' clock: seconds per tick */
+#define REQUEST_TICK 0.001
+/* define REQUEST_TIMEOUT for how long a request waits for its answer from a
+ * device that hasn't answered before */
+#define REQUEST_TIMEOUT 1.0
+/* define REQUEST_MIN_RTO/REQUEST_MAX_RTO for the range of a device's RTO */
+#define REQUEST_MIN_RTO 0.005
+#define REQUEST_MAX_RTO 10.0
+/* define REQUEST_RETRIES for how many times a request is resent by default */
+#define REQUEST_RETRIES 2
+/* define REQUEST_MAX_PACKET for the largest packet kept for resending */
+#define REQUEST_MAX_PACKET (4 + 255 + 4)
+/* define RTT_BUCKETS for the latency histogram: 4 per power of 2 of ns */
+#define RTT_BUCKETS (64 * 4)
+
+/* How a request ended */
+typedef enum request_status
+{
+	eRequestAnswered = 0,
+	eRequestError = 1,		// Answered with eError
+	eRequestTimedOut = 2
+} request_status_t;
+
+/* One open request */
+typedef struct request_t
+{
+	uint8_t dst;
+	uint8_t cmd;
+	uint8_t tries;			// Times sent
+	uint64_t sentAt;		// ns, first send
+	uint64_t lastSentAt;	// ns
+	uint64_t deadline;		// ns
+	uint64_t rtt;			// ns from the first send, once answered
+	uint16_t losses;		// Losses of its dst + cmd when it was sent
+	int next;				// Next request open to the same device, oldest first
+	int prev;
+	uint16_t size;
+	uint8_t packet[REQUEST_MAX_PACKET];		// To send again
+} request_t;
+
+/* A device's round-trip estimate */
+typedef struct device_rtt_t
+{
+	uint64_t srtt;			// ns
+	uint64_t rttvar;		// ns
+	uint64_t rto;			// ns, backoff included; 0 until the first answer
+	uint64_t backoffAt;		// ns, last time rto doubled; 0 since the last answer
+	uint64_t samples;
+} device_rtt_t;
+
+/* Totals since the tracker was made */
+typedef struct tracker_stats_t
+{
+	uint64_t sent;
+	uint64_t answered;
+	uint64_t errors;
+	uint64_t timedOut;		// Given up on, after the retries
+	uint64_t retries;		// Sends again
+	uint64_t late;			// Answers after their request was resent or given up on
+	uint64_t unmatched;		// Answers with no open request, not late either
+	uint64_t rttMin;		// ns, of answered + error requests
+	uint64_t rttMax;
+	uint64_t rttTotal;
+	uint32_t rttBuckets[RTT_BUCKETS];
+} tracker_stats_t;
+
+/* typedef for Send-again function. Returns FALSE if it couldn't */
+typedef bool (*RequestSendFunction)(void * context, const uint8_t * packet, size_t size);
+
+/* typedef for Request-closed function */
+typedef void (*RequestHandlerFunction)(void * context, const request_t & request,
+                                       request_status_t status);
+
+class RequestTracker
+{
+public:
+RequestTracker(size_t capacity);
+~RequestTracker();
+
+/* Requests open at once: 1..capacity */
+bool setWindow(size_t window);
+size_t window() const;
+/* Requests open at once to one device that has answered: 1..capacity */
+bool setDeviceWindow(size_t window);
+size_t deviceWindow() const;
+void setTimeout(double seconds);
+double timeout() const;
+void setRetries(int retries);
+int retries() const;
+void setDoneFunction(RequestHandlerFunction RequestDoneFunction, void * context);
+void setSendFunction(RequestSendFunction SendFunction, void * context);
+
+/* Sending. Call sent() with the packet once it went out; it returns the
+ * request's index, or -1 if it isn't tracked (a broadcast, or no room) */
+bool canSend() const;
+bool canSend(uint8_t dst) const;
+int sent(const uint8_t * packet, size_t size, uint64_t now);
+
+/* Receiving. Returns TRUE if the packet answered an open request */
+bool answered(const PacketView & packet, uint64_t now);
+
+/* Resends or closes requests past their deadline. Returns seconds until
+ * the next deadline, 0 if none are open */
+double run(uint64_t now);
+
+/* Seconds a request to dst gets before it's resent */
+double rto(uint8_t dst) const;
+const device_rtt_t & deviceRtt(uint8_t dst) const;
+
+size_t inFlight() const;
+const tracker_stats_t & stats() const;
+
+/* Latency percentile (0..1) of answered requests, ns. From the histogram,
+ * so to within 12.5% */
+uint64_t percentile(double fraction) const;
+
+/* Prints the totals, round-trip times and each device's estimate */
+void report(FILE * out) const;
+
+private:
+static void deadlineExpired(void * context, int timer, uint64_t due);
+void expired(int index);
+void close(int index, request_status_t status);
+int find(uint8_t dst, uint8_t cmd) const;
+int find(uint8_t dst, uint8_t cmd, int from) const;
+void sample(uint8_t dst, uint64_t rtt);
+void endBackoff(uint8_t dst);
+uint64_t estimatedRto(uint8_t dst) const;
+void setDeadline(int index);
+void owe(uint8_t dst, uint8_t cmd);
+
+request_t * _requests;
+size_t _capacity;
+size_t _window;
+size_t _deviceWindow;
+size_t _inFlight;
+int _free;				// Unused requests, linked through next
+int _oldest[256];		// Per device: its oldest open request, -1 if none
+int _newest[256];
+size_t _open[256];		// Per device: its open requests
+TimerWheel _deadlines;
+uint64_t _timeout;		// ns
+int _retries;
+uint64_t _start;		// ns at tick 0
+uint64_t _now;			// ns, of the current run()
+bool _started;
+tracker_stats_t _stats;
+device_rtt_t _rtt[256];
+uint64_t _owed[256][4];	// Per device, bit per command: an answer may still come late
+uint16_t _losses[256][256];	// Per device and command: requests resent or given up on
+
+RequestHandlerFunction RequestDoneFunction;
+void * _context;
+RequestSendFunction SendFunction;
+void * _sendContext;
+};
+
+#endif // RequestTracker_h
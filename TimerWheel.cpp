@@ -0,0 +1,244 @@
+/*
+ * TimerWheel.cpp
+ *
+ * Defines the TimerWheel class.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "TimerWheel.h"
+
+#include <new>
+#include <string.h>
+
+/* Slot a tick falls in at a level */
+static inline int slotOf(uint64_t tick, int level)
+{
+	return (tick >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+}
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+TimerWheel::TimerWheel(size_t capacity, WheelExpiredFunction TimerExpiredFunction, void * context)
+	: _capacity(0), _now(0), _numScheduled(0),
+	  TimerExpiredFunction(TimerExpiredFunction), _context(context)
+{
+	_timers = new (std::nothrow) wheel_timer_t[capacity];
+	if (_timers) _capacity = capacity;
+	for (size_t i = 0; i < _capacity; i++) _timers[i].level = -1;
+
+	memset(_slots, 0xFF, sizeof(_slots));
+	memset(_occupied, 0, sizeof(_occupied));
+}
+
+TimerWheel::~TimerWheel()
+{
+	delete[] _timers;
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Takes the timer off the wheel if it was on it
+ * --Puts it in the slot for its due tick: the lowest level whose slots
+ *   above it agree with now, so it is reached before it is due
+ *
+ * Function params:
+ * timer:		0..capacity-1
+ * due:			Tick to expire at
+ *
+ */
+bool TimerWheel::schedule(int timer, uint64_t due)
+{
+	if (timer < 0 || (size_t) timer >= _capacity) return false;
+	if (due <= _now) due = _now + 1;
+	if (due - _now >= WHEEL_RANGE) return false;
+
+	cancel(timer);
+	_timers[timer].due = due;
+	insert(timer);
+	_numScheduled++;
+	return true;
+}
+
+void TimerWheel::cancel(int timer)
+{
+	if (!isScheduled(timer)) return;
+	unlink(timer);
+	_numScheduled--;
+}
+
+bool TimerWheel::isScheduled(int timer) const
+{
+	return timer >= 0 && (size_t) timer < _capacity && _timers[timer].level >= 0;
+}
+
+/* Function flow:
+ * --Links a timer into the slot its due tick maps to, relative to now. A
+ *   timer due now (while cascading) lands in the level 0 slot being expired
+ *
+ */
+void TimerWheel::insert(int timer)
+{
+	wheel_timer_t & t = _timers[timer];
+	int level = 0;
+
+	while (level < WHEEL_LEVELS - 1 &&
+	       (t.due >> ((level + 1) * WHEEL_BITS)) != (_now >> ((level + 1) * WHEEL_BITS)))
+	{
+		level++;
+	}
+
+	int slot = slotOf(t.due, level);
+	t.level = level;
+	t.slot = slot;
+	t.prev = -1;
+	t.next = _slots[level][slot];
+	if (t.next >= 0) _timers[t.next].prev = timer;
+	_slots[level][slot] = timer;
+	_occupied[level] |= 1ull << slot;
+}
+
+void TimerWheel::unlink(int timer)
+{
+	wheel_timer_t & t = _timers[timer];
+
+	if (t.prev >= 0) _timers[t.prev].next = t.next;
+	else _slots[t.level][t.slot] = t.next;
+	if (t.next >= 0) _timers[t.next].prev = t.prev;
+	if (_slots[t.level][t.slot] < 0) _occupied[t.level] &= ~(1ull << t.slot);
+	t.level = -1;
+}
+
+/* Function flow:
+ * --now just reached the start of this level's current slot: moves every
+ *   timer in it down to the level(s) below
+ *
+ */
+void TimerWheel::cascade(int level)
+{
+	int slot = slotOf(_now, level);
+	int timer = _slots[level][slot];
+
+	_slots[level][slot] = -1;
+	_occupied[level] &= ~(1ull << slot);
+	while (timer >= 0)
+	{
+		int next = _timers[timer].next;
+		insert(timer);
+		timer = next;
+	}
+}
+
+/* Function flow:
+ * --Detaches the level 0 slot of now, then calls the expiry function for
+ *   each timer in it. A timer the function reschedules goes back on the
+ *   wheel, never into the list being walked
+ * --Returns how many expired
+ *
+ */
+size_t TimerWheel::expire(int slot)
+{
+	int timer = _slots[0][slot];
+	size_t expired = 0;
+
+	_slots[0][slot] = -1;
+	_occupied[0] &= ~(1ull << slot);
+	while (timer >= 0)
+	{
+		int next = _timers[timer].next;
+		uint64_t due = _timers[timer].due;
+
+		_timers[timer].level = -1;
+		_numScheduled--;
+		expired++;
+		if (TimerExpiredFunction) TimerExpiredFunction(_context, timer, due);
+		timer = next;
+	}
+	return expired;
+}
+
+/* Function flow:
+ * --Jumps from one tick with work (see nextExpiry()) to the next, up to
+ *   'now', rather than stepping through every tick
+ * --At each: moves the timers of any level whose slot just started down,
+ *   highest level first, then expires level 0's slot
+ *
+ */
+size_t TimerWheel::advance(uint64_t now)
+{
+	size_t expired = 0;
+
+	while (_now < now)
+	{
+		uint64_t next = nextExpiry();
+		if (next > now)
+		{
+			_now = now;
+			break;
+		}
+		_now = next;
+
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--)
+		{
+			uint64_t below = (1ull << (level * WHEEL_BITS)) - 1;
+			if ((_now & below) == 0) cascade(level);
+		}
+		expired += expire(slotOf(_now, 0));
+	}
+	return expired;
+}
+
+/* Function flow:
+ * --For each level, the start of its next slot in use: timers in a level
+ *   are always in slots after now's, within the current turn of the level
+ *   above. The top level has no level above, so a timer there can also be
+ *   in its next turn
+ * --Returns the earliest of them
+ *
+ */
+uint64_t TimerWheel::nextExpiry() const
+{
+	uint64_t next = WHEEL_NEVER;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+	{
+		if (!_occupied[level]) continue;
+
+		int shift = level * WHEEL_BITS;
+		int slot = slotOf(_now, level);
+		uint64_t turn = _now & ~((1ull << (shift + WHEEL_BITS)) - 1);
+		uint64_t later = slot == WHEEL_SLOTS - 1 ? 0 : _occupied[level] & (~0ull << (slot + 1));
+
+		if (!later && level == WHEEL_LEVELS - 1)
+		{
+			later = _occupied[level];
+			turn += WHEEL_RANGE;
+		}
+		if (!later) continue;
+
+		uint64_t tick = turn + ((uint64_t) __builtin_ctzll(later) << shift);
+		if (tick < next) next = tick;
+	}
+	return next;
+}
+
+uint64_t TimerWheel::now() const
+{
+	return _now;
+}
+
+size_t TimerWheel::numScheduled() const
+{
+	return _numScheduled;
+}
+
+size_t TimerWheel::capacity() const
+{
+	return _capacity;
+}
@@ -0,0 +1,89 @@
+/*
+ * TimerWheel.h
+ *
+ * Declares a hierarchical timer wheel: many timers, all on one clock of
+ * whole ticks, each added, cancelled and expired in constant time. Level 0
+ * has a slot per tick for the next 64 ticks; each level above covers 64
+ * slots of the one below, so 4 levels reach 2^24 ticks (4.6 hours of 1 ms
+ * ticks). A timer due further out waits in a higher level and moves down
+ * as its time comes closer.
+ *
+ * The wheel keeps no time of its own: the owner calls advance() with the
+ * current tick, and nextExpiry() says when calling it again is worthwhile,
+ * so a caller sleeping on a timerfd only wakes when something is due.
+ *
+ * Timers are numbered 0..capacity-1 and owned by the caller, which can
+ * reschedule one from its own expiry function.
+ *
+ */
+
+#ifndef TimerWheel_h
+#define TimerWheel_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* define WHEEL_LEVELS/WHEEL_BITS for the shape of the wheel: 64 slots a level */
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+/* define WHEEL_RANGE for how far ahead (in ticks) a timer can be set */
+#define WHEEL_RANGE (1ull << (WHEEL_LEVELS * WHEEL_BITS))
+/* define WHEEL_NEVER for nextExpiry() when no timer is set */
+#define WHEEL_NEVER UINT64_MAX
+
+/* typedef for On-timer-expired function. 'due' is the tick it was set for */
+typedef void (*WheelExpiredFunction)(void * context, int timer, uint64_t due);
+
+class TimerWheel
+{
+public:
+TimerWheel(size_t capacity, WheelExpiredFunction TimerExpiredFunction, void * context);
+~TimerWheel();
+
+/* Sets (or moves) a timer to expire at tick 'due'. A due tick already past
+ * expires on the next tick. Returns FALSE if timer is out of range or due is
+ * WHEEL_RANGE or more ticks away */
+bool schedule(int timer, uint64_t due);
+void cancel(int timer);
+bool isScheduled(int timer) const;
+
+/* Expires every timer due up to and including tick 'now'. Returns how many */
+size_t advance(uint64_t now);
+
+/* Earliest tick advance() has work at: a timer expiring or one moving down
+ * a level. WHEEL_NEVER if no timer is set */
+uint64_t nextExpiry() const;
+
+uint64_t now() const;
+size_t numScheduled() const;
+size_t capacity() const;
+
+private:
+/* One timer: its place in a slot's list */
+struct wheel_timer_t
+{
+	uint64_t due;
+	int next;
+	int prev;
+	int16_t level;		// -1 when not scheduled
+	int16_t slot;
+};
+
+void insert(int timer);
+void unlink(int timer);
+void cascade(int level);
+size_t expire(int slot);
+
+wheel_timer_t * _timers;
+size_t _capacity;
+int _slots[WHEEL_LEVELS][WHEEL_SLOTS];		// Head of each slot's list, -1 if empty
+uint64_t _occupied[WHEEL_LEVELS];			// Bit per non-empty slot
+uint64_t _now;
+size_t _numScheduled;
+
+WheelExpiredFunction TimerExpiredFunction;
+void * _context;
+};
+
+#endif // TimerWheel_h
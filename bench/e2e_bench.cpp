@@ -0,0 +1,424 @@
+/*
+ * e2e_bench.cpp
+ *
+ * End-to-end benchmark of the host's serial path over a pty loopback:
+ *	queue/flush -> COBS encode -> tty -> echo -> tty -> read ->
+ *	COBS decode -> checkPacket
+ * The port under test opens the slave side of a pty pair; a thread on the
+ * master side writes back every byte it reads, so each frame comes back to
+ * the port that sent it. Frames return in order, so a frame's latency is
+ * from when it was queued to when its echo was decoded and checked.
+ *
+ * The port is read + written by one of three backends (--backend):
+ *	byte		A SerialPort read one byte per read(), the way
+ *				SerialPort::update did before it read in bulk
+ *	epoll		A PortManager on an EventLoop, as hsk runs it: bulk read()s
+ *				and one writev() per batch (the default)
+ *	io_uring	The same PortManager through io_uring (see useIoUring())
+ *
+ * Sweeps payload length, marker density (fraction of payload bytes equal to
+ * PACKETMARKER, the worst case for COBS) and pipeline depth (frames in
+ * flight). One CSV line per point:
+ *	backend,payload_bytes,marker_density,depth,frames,frames_per_s,MB_per_s,
+ *	p50_us,p99_us,p999_us,cpu_ns_per_frame,echo_cpu_ns_per_frame,
+ *	syscalls_per_frame,bad_frames
+ * cpu_ns_per_frame is the thread driving the port (io_uring's kernel
+ * workers aren't in it); the echo thread's is reported separately, as it
+ * stands in for the board. syscalls_per_frame counts the system calls made
+ * to read + write the port (SerialPort::ioCalls(), PortManager::ioSyscalls()),
+ * not the waits for it.
+ *
+ * Build + run from the repository root:
+ *	make e2e_bench
+ *	build/e2e_bench > e2e.csv
+ *
+ * Options:
+ *	--payloads 0,16,64,128,255		Payload lengths to sweep
+ *	--densities 0,0.5,1				Marker densities to sweep
+ *	--depths 1,8,64					Pipeline depths to sweep
+ *	--duration S					Seconds per point (0.5)
+ *	--integrity sum|crc16|crc32c	Trailer of the frames (sum)
+ *	--backend byte|epoll|io_uring	How the port is read + written (epoll)
+ *
+ */
+
+#include "../COBS.h"
+#include "../Packet.h"
+#include "../iProtocol.h"
+#include "../linux_src/PortManager_linux.h"
+#include "../linux_src/SerialPort_linux.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/* define MAX_DEPTH for the most frames a point keeps in flight */
+#define MAX_DEPTH TX_QUEUE_DEPTH
+/* define FRAME_SOURCE/FRAME_DEST for the addresses the frames carry */
+#define FRAME_SOURCE eMagnetHsk
+#define FRAME_DEST eSFC
+
+/* How the port under test is read + written */
+typedef enum bench_backend
+{
+	eBackendByte = 0,		// SerialPort, one read() per byte
+	eBackendEpoll = 1,		// PortManager on an EventLoop
+	eBackendIoUring = 2		// PortManager through io_uring
+} bench_backend_t;
+
+static const char * backendNames[] = { "byte", "epoll", "io_uring" };
+
+/* One point of the sweep */
+typedef struct bench_point_t
+{
+	int payload;
+	double density;
+	int depth;
+} bench_point_t;
+
+/* What one point measured */
+typedef struct bench_result_t
+{
+	uint64_t frames;
+	uint64_t bad;
+	double seconds;
+	double bytes;
+	double p50, p99, p999;		// us
+	double cpuNs;				// per frame, SerialPort thread
+	double echoCpuNs;			// per frame, echo thread
+	double syscalls;			// per frame, reading + writing the port
+} bench_result_t;
+
+/* State of the point being run, shared with the packet handlers */
+static bench_backend_t backend = eBackendEpoll;
+static SerialPort * port;				// byte backend
+static PortManager * ports;				// epoll + io_uring backends
+static uint64_t byteReads;				// byte backend: read()s so far
+static uint64_t sendTimes[MAX_DEPTH];	// Queue times of the frames in flight, oldest at 'returned'
+static uint64_t queued;
+static uint64_t returned;
+static uint64_t badFrames;
+static std::vector<uint32_t> latencies;
+static double returnedBytes;
+
+static uint64_t nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t threadCpuNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*****************************************************************************
+ * Echo side
+ ****************************************************************************/
+static std::atomic<uint64_t> echoCpu;
+
+/* Function flow:
+ * --Writes back every byte read from the pty master, until the slave side
+ *   is closed (read() fails)
+ *
+ */
+static void echo(int master)
+{
+	uint8_t bytes[READ_CHUNK];
+	ssize_t n;
+
+	while ((n = read(master, bytes, sizeof(bytes))) > 0)
+	{
+		for (ssize_t done = 0; done < n; )
+		{
+			ssize_t w = write(master, bytes + done, n - done);
+			if (w <= 0) break;
+			done += w;
+		}
+	}
+	echoCpu.store(threadCpuNs());
+}
+
+/*****************************************************************************
+ * SerialPort side
+ ****************************************************************************/
+
+/* Function flow:
+ * --Times a decoded frame against the oldest frame in flight
+ *
+ */
+static void frameChecked(const void * sender, const uint8_t * buffer, size_t size,
+                         packet_status_t status)
+{
+	if (status != ePacketOK) badFrames++;
+	if (returned == queued) return;
+
+	latencies.push_back((uint32_t)(nowNs() - sendTimes[returned % MAX_DEPTH]));
+	returned++;
+	returnedBytes += size;
+}
+
+/* byte backend: the SerialPort's handler. Checks the frame the way the
+ * host does, as PortManager would have */
+static void frameReturned(const uint8_t * buffer, size_t size)
+{
+	frameChecked(port, buffer, size, checkPacket(buffer, size, port->packetSum(), FRAME_DEST));
+}
+
+/* Function flow:
+ * --byte backend: reads the port one byte per read() until it is empty,
+ *   the way SerialPort::update used to, and decodes each byte as it comes
+ *
+ */
+static void readBytes(uint8_t * decoded)
+{
+	uint8_t byte;
+
+	for (;;)
+	{
+		ssize_t got = read(port->getHandle(), &byte, 1);
+		byteReads++;
+		if (got != 1) break;
+		port->receive(&byte, 1, decoded);
+	}
+}
+
+/* Function flow:
+ * --Fills in a frame: random payload bytes, 'density' of them PACKETMARKER
+ * --Returns the frame's size, trailer included
+ *
+ */
+static size_t makeFrame(uint8_t * frame, int payload, double density)
+{
+	PacketBuilder packet(frame, MAX_PACKET_LENGTH);
+
+	packet.setHeader(FRAME_SOURCE, FRAME_DEST, eTestMode, payload);
+	for (int i = 0; i < payload; i++)
+	{
+		uint8_t byte = rand();
+		if (byte == PACKETMARKER) byte++;
+		packet.payload()[i] = rand() < density * RAND_MAX ? PACKETMARKER : byte;
+	}
+	return packet.finish();
+}
+
+static double percentile(std::vector<uint32_t> & values, double p)
+{
+	if (values.empty()) return 0;
+	size_t at = std::min(values.size() - 1, (size_t)(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + at, values.end());
+	return values[at] / 1e3;
+}
+
+/* Function flow:
+ * --Opens a fresh pty pair, the backend's port on its slave and the echo
+ *   thread on its master
+ * --For 'seconds': keeps 'depth' frames in flight, sleeping until the port
+ *   can be read or written: in the EventLoop, or in poll() for the byte
+ *   backend
+ * --Waits for the frames still in flight, counts the system calls made,
+ *   then tears it all down
+ *
+ */
+static bench_result_t runPoint(const bench_point_t & point, double seconds)
+{
+	bench_result_t result = {};
+	uint8_t frames[16][MAX_PACKET_LENGTH];
+	size_t sizes[16];
+	uint8_t decoded[MAX_PACKET_LENGTH];
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+	{
+		printf("error %d opening a pty: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	EventLoop loop;
+	if (backend == eBackendByte)
+	{
+		port = new SerialPort(ptsname(master), 115200, 0);
+		port->setPacketHandler(&frameReturned);
+		port->setPacketTimeout(0);
+	}
+	else
+	{
+		ports = new PortManager(&loop);
+		if (backend == eBackendIoUring && !ports->useIoUring())
+		{
+			printf("error: io_uring is unavailable\n");
+			exit(1);
+		}
+		ports->setAddress(FRAME_DEST);
+		ports->setPacketTimeout(0);
+		ports->setPacketHandler(&frameChecked);
+		if (ports->addPort(ptsname(master), 115200) < 0)
+		{
+			printf("error opening %s\n", ptsname(master));
+			exit(1);
+		}
+	}
+	byteReads = 0;
+	std::thread echoThread(echo, master);
+
+	for (int i = 0; i < 16; i++) sizes[i] = makeFrame(frames[i], point.payload, point.density);
+	queued = returned = badFrames = 0;
+	returnedBytes = 0;
+	latencies.clear();
+
+	uint64_t start = nowNs();
+	uint64_t cpuStart = threadCpuNs();
+	uint64_t end = start + (uint64_t)(seconds * 1e9);
+	uint64_t drainBy = end + 1000000000ull;
+
+	for (;;)
+	{
+		uint64_t now = nowNs();
+		bool sending = now < end;
+
+		if (!sending && (returned == queued || now > drainBy)) break;
+		while (sending && queued - returned < (uint64_t) point.depth)
+		{
+			uint8_t * frame = frames[queued % 16];
+			size_t size = sizes[queued % 16];
+
+			if (!(port ? port->queue(frame, size) : ports->queue(FRAME_DEST, frame, size))) break;
+			sendTimes[queued % MAX_DEPTH] = nowNs();
+			queued++;
+		}
+
+		if (ports)
+		{
+			ports->flush();
+			loop.runOnce(100);
+			continue;
+		}
+
+		port->flush();
+		struct pollfd fd = { port->getHandle(), POLLIN, 0 };
+		if (port->txPending()) fd.events |= POLLOUT;
+		if (poll(&fd, 1, 100) > 0 && (fd.revents & POLLIN)) readBytes(decoded);
+	}
+
+	result.seconds = (nowNs() - start) / 1e9;
+	result.cpuNs = threadCpuNs() - cpuStart;
+	result.syscalls = port ? byteReads + port->ioCalls() : ports->ioSyscalls();
+
+	/* Closes the slave: the echo thread's read() fails */
+	delete port;
+	delete ports;
+	port = 0;
+	ports = 0;
+	echoThread.join();
+	close(master);
+
+	result.frames = returned;
+	result.bad = badFrames;
+	result.bytes = returnedBytes;
+	result.p50 = percentile(latencies, 0.50);
+	result.p99 = percentile(latencies, 0.99);
+	result.p999 = percentile(latencies, 0.999);
+	if (returned)
+	{
+		result.cpuNs /= returned;
+		result.echoCpuNs = echoCpu.load() / (double) returned;
+		result.syscalls /= returned;
+	}
+	return result;
+}
+
+/* Parses "a,b,c" into values */
+template <typename T>
+static std::vector<T> parseList(const char * list)
+{
+	std::vector<T> values;
+	for (const char * p = list; *p; )
+	{
+		char * next;
+		values.push_back((T) strtod(p, &next));
+		if (next == p) break;
+		p = *next == ',' ? next + 1 : next;
+	}
+	return values;
+}
+
+int main(int argc, char ** argv)
+{
+	static const struct option options[] = {
+		{ "payloads", required_argument, 0, 'p' },
+		{ "densities", required_argument, 0, 'm' },
+		{ "depths", required_argument, 0, 'd' },
+		{ "duration", required_argument, 0, 't' },
+		{ "integrity", required_argument, 0, 'i' },
+		{ "backend", required_argument, 0, 'b' },
+		{ 0, 0, 0, 0 }
+	};
+	std::vector<int> payloads = parseList<int>("0,16,64,128,255");
+	std::vector<double> densities = parseList<double>("0,0.5,1");
+	std::vector<int> depths = parseList<int>("1,8,64");
+	double seconds = 0.5;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", options, 0)) != -1)
+	{
+		switch (option)
+		{
+			case 'p':	payloads = parseList<int>(optarg); break;
+			case 'm':	densities = parseList<double>(optarg); break;
+			case 'd':	depths = parseList<int>(optarg); break;
+			case 't':	seconds = atof(optarg); break;
+			case 'i':
+				setIntegrity(FRAME_SOURCE, !strcmp(optarg, "crc16") ? eIntegrityCRC16 :
+				             !strcmp(optarg, "crc32c") ? eIntegrityCRC32C : eIntegritySum);
+				setIntegrity(FRAME_DEST, getIntegrity(FRAME_SOURCE));
+				break;
+			case 'b':
+				backend = !strcmp(optarg, "byte") ? eBackendByte :
+				          !strcmp(optarg, "io_uring") ? eBackendIoUring : eBackendEpoll;
+				break;
+			default:
+				printf("usage: %s [--payloads 0,16,...] [--densities 0,0.5,...] "
+				       "[--depths 1,8,...] [--duration S] [--integrity sum|crc16|crc32c]\n"
+				       "       [--backend byte|epoll|io_uring]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	printf("backend,payload_bytes,marker_density,depth,frames,frames_per_s,MB_per_s,"
+	       "p50_us,p99_us,p999_us,cpu_ns_per_frame,echo_cpu_ns_per_frame,"
+	       "syscalls_per_frame,bad_frames\n");
+	for (int payload : payloads)
+	{
+		for (double density : densities)
+		{
+			if (payload == 0 && density != densities[0]) continue;	// Nothing to vary
+			for (int depth : depths)
+			{
+				bench_point_t point = { std::clamp(payload, 0, 255), density,
+				                        std::clamp(depth, 1, MAX_DEPTH) };
+				bench_result_t r = runPoint(point, seconds);
+
+				printf("%s,%d,%.2f,%d,%llu,%.0f,%.2f,%.1f,%.1f,%.1f,%.0f,%.0f,%.2f,%llu\n",
+				       backendNames[backend], point.payload, point.density, point.depth,
+				       (unsigned long long) r.frames, r.frames / r.seconds,
+				       r.bytes / r.seconds / 1e6, r.p50, r.p99, r.p999,
+				       r.cpuNs, r.echoCpuNs, r.syscalls, (unsigned long long) r.bad);
+				fflush(stdout);
+			}
+		}
+	}
+	return 0;
+}
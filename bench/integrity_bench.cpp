@@ -0,0 +1,131 @@
+/*
+ * integrity_bench.cpp
+ *
+ * Compares the integrity modes a packet trailer can carry (see iProtocol.h):
+ * the 1-byte sum, CRC-16/CCITT and CRC-32C (SSE4.2 and tables), on packets
+ * of the sizes the boards send. Reports ns per packet and MB/s for filling a
+ * trailer and for verifying one, plus how many single adjacent-byte swaps
+ * each mode lets through.
+ *
+ * Build + run from the repository root:
+ *	make integrity_bench
+ *	build/integrity_bench
+ *
+ */
+
+#include "../iProtocol.h"
+#include "../CRC.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* define PACKETS for how many different packets each measurement cycles over */
+#define PACKETS 1024
+/* define ROUNDS for how many times each measurement goes over them */
+#define ROUNDS 2000
+
+static uint8_t packets[PACKETS][4 + 255 + MAX_TRAILER_LENGTH];
+static volatile uint32_t sink;
+
+/* Function flow:
+ * --Fills every packet with a header + 'payload' random bytes
+ */
+static void makePackets(int payload)
+{
+	for (int i = 0; i < PACKETS; i++)
+	{
+		housekeeping_hdr_t * hdr = (housekeeping_hdr_t *) packets[i];
+		for (int j = 0; j < 4 + payload; j++) packets[i][j] = rand();
+		hdr->len = payload;
+	}
+}
+
+static double nowNs()
+{
+	return std::chrono::duration<double, std::nano>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Function flow:
+ * --Times 'work' over every packet ROUNDS times
+ * --Returns ns per packet
+ */
+template <typename Work>
+static double timePackets(Work work)
+{
+	double start = nowNs();
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (int i = 0; i < PACKETS; i++) work(packets[i]);
+	}
+	return (nowNs() - start) / ((double) ROUNDS * PACKETS);
+}
+
+static const char * modeName(integrity_mode_t mode)
+{
+	switch (mode)
+	{
+		case eIntegrityCRC16:	return "crc16";
+		case eIntegrityCRC32C:	return CRC::hardwareCrc32c() ? "crc32c-sse4.2" : "crc32c-table";
+		default:				return "sum8";
+	}
+}
+
+/* Function flow:
+ * --Swaps two different adjacent payload bytes of a good packet, once per
+ *   packet, and counts the packets that still verify
+ */
+static int missedSwaps(integrity_mode_t mode, int payload)
+{
+	int missed = 0;
+
+	if (payload < 2) return 0;
+	for (int i = 0; i < PACKETS; i++)
+	{
+		uint8_t * p = packets[i];
+		int at = 4 + i % (payload - 1);
+
+		fillTrailer(p, mode);
+		if (p[at] == p[at + 1]) p[at + 1]++;
+		uint8_t swap = p[at];
+		p[at] = p[at + 1];
+		p[at + 1] = swap;
+		if (verifyTrailer(p, mode)) missed++;
+	}
+	return missed;
+}
+
+int main()
+{
+	const integrity_mode_t modes[] = { eIntegritySum, eIntegrityCRC16, eIntegrityCRC32C };
+	const int payloads[] = { 0, 16, 64, 255 };
+
+	printf("mode,payload_bytes,fill_ns,verify_ns,verify_MBps,missed_swaps_of_%d\n", PACKETS);
+	for (int payload : payloads)
+	{
+		for (integrity_mode_t mode : modes)
+		{
+			makePackets(payload);
+			double fill = timePackets([mode](uint8_t * p) { fillTrailer(p, mode); });
+			double verify = timePackets([mode](uint8_t * p) { sink += verifyTrailer(p, mode); });
+			double bytes = 4 + payload + trailerSize(mode);
+
+			printf("%s,%d,%.1f,%.1f,%.0f,%d\n", modeName(mode), payload, fill, verify,
+			       bytes / verify * 1e3, missedSwaps(mode, payload));
+		}
+
+		/* The table engine, for comparison, when SSE4.2 did the above */
+		if (CRC::hardwareCrc32c())
+		{
+			makePackets(payload);
+			double crc = timePackets([](uint8_t * p) {
+				sink += CRC::crc32cTables(p, 4 + ((housekeeping_hdr_t *) p)->len);
+			});
+			printf("crc32c-table,%d,%.1f,%.1f,%.0f,\n", payload, crc, crc,
+			       (4 + payload + 4) / crc * 1e3);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * micro_bench.cpp
+ *
+ * Per-primitive timings of the host stack, each on its own with nothing
+ * else in the loop: COBS::encode, COBS::decode, COBSDecoder::feed (what
+ * SerialPort decodes with), getEncodedBufferSize, fillChecksum,
+ * verifyChecksum, checkPacket, findMe, DeviceRegistry::recordPacket and
+ * CommandTable::dispatch (commandCenter's table, as main.cpp registers it).
+ *
+ * Inputs, each as 1024 different frames (header + payload + 1-byte sum):
+ *	--random:		random payload bytes, PACKETMARKER as likely as any other
+ *	--no_marker:	random payload bytes, never PACKETMARKER
+ *	--all_marker:	every payload byte PACKETMARKER, COBS's worst case
+ *	--captured:		the frames in debug_testmode.txt (a DCT board in test
+ *					mode), rebuilt from the transcript
+ * findMe and recordPacket look up device addresses instead, out of lists
+ * of 4 and 254 known devices.
+ *
+ * One CSV line per primitive / input / payload length:
+ *	primitive,input,payload_bytes,ns_per_frame,ns_per_byte,tsc_cycles_per_frame
+ * Cycles are TSC ticks (constant rate, not core clocks). With --baseline,
+ * a speedup column compares each line with the same line of an earlier
+ * run's CSV, so a change can be measured before and after.
+ *
+ * Build + run from the repository root:
+ *	make micro_bench
+ *	build/micro_bench > before.csv
+ *	... change something, rebuild ...
+ *	build/micro_bench --baseline before.csv
+ *
+ * Options:
+ *	--baseline FILE		Earlier output to compare with
+ *	--capture FILE		Transcript to rebuild the captured frames from
+ *						(debug_testmode.txt)
+ *	--filter NAME		Only run primitives whose name contains NAME
+ *	--time S			Seconds to spend on each line (0.2)
+ *
+ */
+
+#include "../COBS.h"
+#include "../CommandTable.h"
+#include "../DeviceRegistry.h"
+#include "../Packet.h"
+#include "../iProtocol.h"
+
+#include <chrono>
+#include <getopt.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t ticks() { return __rdtsc(); }
+#else
+static inline uint64_t ticks() { return 0; }
+#endif
+
+/* define FRAMES for how many different frames each measurement cycles over */
+#define FRAMES 1024
+/* define MAX_FRAME for the largest frame: header, 255 bytes, 1-byte sum */
+#define MAX_FRAME (4 + 255 + 1)
+
+/* One input: FRAMES frames, encoded and not */
+struct input_t
+{
+	std::string name;
+	int payload;		// -1: mixed (captured)
+	std::vector<std::vector<uint8_t>> frames;
+	std::vector<std::vector<uint8_t>> encoded;	// With the trailing PACKETMARKER
+	double bytes;		// Average frame size
+};
+
+static double seconds = 0.2;
+static const char * filter = 0;
+static std::map<std::string, double> baseline;
+static volatile uint64_t sink;
+
+/*****************************************************************************
+ * Inputs
+ ****************************************************************************/
+static void finishInput(input_t & input)
+{
+	input.bytes = 0;
+	for (auto & frame : input.frames)
+	{
+		std::vector<uint8_t> encoded(COBS::getEncodedBufferSize(frame.size()));
+		encoded.resize(COBS::encode(frame.data(), frame.size(), encoded.data()));
+		input.encoded.push_back(encoded);
+		input.bytes += frame.size();
+	}
+	input.bytes /= input.frames.size();
+}
+
+/* Function flow:
+ * --Makes FRAMES frames of one payload length, their payload bytes drawn
+ *   the way 'kind' says
+ *
+ */
+static input_t makeInput(const char * kind, int payload)
+{
+	input_t input;
+	input.name = kind;
+	input.payload = payload;
+
+	for (int i = 0; i < FRAMES; i++)
+	{
+		std::vector<uint8_t> frame(4 + payload + 1);
+		PacketBuilder packet(frame.data(), frame.size());
+
+		packet.setHeader(eMagnetHsk, eSFC, eTestMode, payload);
+		for (int j = 0; j < payload; j++)
+		{
+			uint8_t byte = rand();
+			if (!strcmp(kind, "all_marker")) byte = PACKETMARKER;
+			else if (!strcmp(kind, "no_marker") && byte == PACKETMARKER) byte++;
+			packet.payload()[j] = byte;
+		}
+		fillChecksum(frame.data());
+		input.frames.push_back(frame);
+	}
+	finishInput(input);
+	return input;
+}
+
+/* Function flow:
+ * --Rebuilds the frames a transcript of main.cpp shows: each "Reading in
+ *   packet header..." block gives the source, destination, command, length
+ *   and the DATA bytes
+ * --Repeats them up to FRAMES frames
+ * --Returns an input without frames if the file can't be read
+ *
+ */
+static input_t readCapture(const char * path)
+{
+	input_t input;
+	input.name = "captured";
+	input.payload = -1;
+
+	FILE * file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "No %s: skipping the captured input\n", path);
+		return input;
+	}
+
+	std::vector<std::vector<uint8_t>> captured;
+	std::vector<uint8_t> frame(4, 0);
+	char line[4096];
+	int value;
+
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "Packet source: %d", &value) == 1) frame[1] = value;
+		else if (sscanf(line, "Intended destination: %d", &value) == 1) frame[0] = value;
+		else if (sscanf(line, "Command : %d", &value) == 1) frame[2] = value;
+		else if (sscanf(line, "Length of data attached: %d", &value) == 1) frame[3] = value;
+		else if (!strncmp(line, "DATA:", 5))
+		{
+			std::vector<uint8_t> packet(frame.begin(), frame.begin() + 4);
+			int offset;
+			for (char * p = line + 5; sscanf(p, "%d%n", &value, &offset) == 1; p += offset)
+			{
+				packet.push_back(value);
+			}
+			if (packet.size() != 4u + packet[3]) continue;
+			packet.push_back(0);
+			fillChecksum(packet.data());
+			captured.push_back(packet);
+		}
+	}
+	fclose(file);
+
+	for (size_t i = 0; !captured.empty() && i < FRAMES; i++)
+	{
+		input.frames.push_back(captured[i % captured.size()]);
+	}
+	if (!input.frames.empty()) finishInput(input);
+	return input;
+}
+
+/*****************************************************************************
+ * Measuring
+ ****************************************************************************/
+
+/* Function flow:
+ * --Runs 'work' over frames 0..FRAMES-1 in rounds until 'seconds' have
+ *   passed (at least 3 rounds), then prints the CSV line
+ *
+ */
+template <typename Work>
+static void measure(const char * primitive, const std::string & input, int payload,
+                    double bytesPerFrame, Work work)
+{
+	if (filter && !strstr(primitive, filter)) return;
+
+	for (int i = 0; i < FRAMES; i++) work(i);	// Warm up
+
+	uint64_t rounds = 0;
+	uint64_t tscStart = ticks();
+	auto start = std::chrono::steady_clock::now();
+	double elapsed;
+	do
+	{
+		for (int i = 0; i < FRAMES; i++) work(i);
+		rounds++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < seconds || rounds < 3);
+	uint64_t tsc = ticks() - tscStart;
+
+	double frames = (double) rounds * FRAMES;
+	double ns = elapsed * 1e9 / frames;
+	char key[128];
+	snprintf(key, sizeof(key), "%s,%s,%d", primitive, input.c_str(), payload);
+
+	printf("%s,%.2f,", key, ns);
+	if (bytesPerFrame > 0) printf("%.3f", ns / bytesPerFrame);
+	printf(",%.0f", tsc / frames);
+	if (!baseline.empty())
+	{
+		auto before = baseline.find(key);
+		if (before != baseline.end()) printf(",%.2f", before->second / ns);
+		else printf(",");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/* Function flow:
+ * --Times every frame primitive on one input
+ *
+ */
+static void measureInput(input_t & input)
+{
+	static uint8_t out[2 * MAX_FRAME];
+	const std::vector<std::vector<uint8_t>> & frames = input.frames;
+	const std::vector<std::vector<uint8_t>> & encoded = input.encoded;
+	std::vector<std::vector<uint8_t>> scratch = input.frames;
+	std::vector<uint8_t> sums;
+
+	for (auto & frame : frames)
+	{
+		uint8_t sum = 0;
+		for (uint8_t byte : frame) sum += byte;
+		sums.push_back(sum);
+	}
+
+	measure("cobs_encode", input.name, input.payload, input.bytes, [&](int i) {
+		sink += COBS::encode(frames[i].data(), frames[i].size(), out);
+	});
+	measure("cobs_decode", input.name, input.payload, input.bytes, [&](int i) {
+		sink += COBS::decode(encoded[i].data(), encoded[i].size() - 1, out, sizeof(out));
+	});
+
+	COBSDecoder decoder;
+	decoder.setOutput(out, sizeof(out));
+	measure("cobs_feed", input.name, input.payload, input.bytes, [&](int i) {
+		sink += decoder.feed(encoded[i].data(), encoded[i].size());
+	});
+
+	measure("encoded_size", input.name, input.payload, input.bytes, [&](int i) {
+		sink += COBS::getEncodedBufferSize(frames[i].size());
+	});
+	measure("fill_checksum", input.name, input.payload, input.bytes, [&](int i) {
+		fillChecksum(scratch[i].data());
+	});
+	measure("verify_checksum", input.name, input.payload, input.bytes, [&](int i) {
+		sink += verifyChecksum(scratch[i].data());
+	});
+	measure("check_packet", input.name, input.payload, input.bytes, [&](int i) {
+		sink += checkPacket(frames[i].data(), frames[i].size(), sums[i], eSFC);
+	});
+}
+
+/*****************************************************************************
+ * Dispatch
+ ****************************************************************************/
+static void handled(const PacketView & packet)
+{
+	sink += packet.cmd();
+}
+
+/* Function flow:
+ * --Times findMe and the registry that replaced it, looking up a mix of
+ *   known addresses, out of a few and out of every possible device
+ * --Times the command table, registered like main.cpp's registerCommands,
+ *   on packets spread over its commands and sources
+ *
+ */
+static void measureDispatch()
+{
+	const int knownCounts[] = { 4, 254 };
+	static DeviceRegistry registry;
+
+	for (int known : knownCounts)
+	{
+		uint8_t devices[254];
+		uint8_t lookups[FRAMES];
+		std::string input = std::to_string(known) + "_devices";
+
+		for (int i = 0; i < known; i++) devices[i] = i + 1;
+		for (int i = 0; i < FRAMES; i++) lookups[i] = devices[rand() % known];
+
+		measure("find_me", input, 0, 0, [&](int i) {
+			sink += findMe(devices, devices + known, lookups[i]) - devices;
+		});
+		measure("registry_record", input, 0, 0, [&](int i) {
+			sink += registry.recordPacket(lookups[i], 9, i);
+		});
+	}
+
+	CommandTable commands;
+	commands.add(ANY_SOURCE, ePingPong, &handled);
+	commands.add(ANY_SOURCE, eSetPriority, &handled, 2, 2);
+	commands.add(ANY_SOURCE, eIntSensorRead, &handled, 1, 4);
+	commands.add(ANY_SOURCE, eMapDevices, &handled);
+	commands.addRange(ANY_SOURCE, eSendLowPriority, eSendHiPriority, &handled);
+	commands.add(ANY_SOURCE, eError, &handled, 4, 4);
+	commands.add(eDCTHsk, ePacketCount, &handled, 4, 4);
+	commands.addRange(eMagnetHsk, 3, 13, &handled, 4, 4);
+	commands.addRange(eMagnetHsk, 14, 15, &handled, 1, 255);
+	commands.addRange(eMagnetHsk, 16, 25, &handled, 4, 4);
+	commands.add(eMagnetHsk, 26, &handled, 1, 255);
+	commands.setDefault(&handled);
+
+	static uint8_t packets[FRAMES][8];
+	for (int i = 0; i < FRAMES; i++)
+	{
+		PacketBuilder packet(packets[i], sizeof(packets[i]));
+		packet.setHeader(1 + rand() % 3, eSFC, rand() % 32, 4);
+	}
+	measure("dispatch", "mixed", 4, 0, [&](int i) {
+		sink += commands.dispatch(PacketView(packets[i], 9));
+	});
+}
+
+/* Reads an earlier run's CSV into baseline: key -> ns_per_frame */
+static void readBaseline(const char * path)
+{
+	FILE * file = fopen(path, "r");
+	char line[512];
+
+	if (!file)
+	{
+		fprintf(stderr, "Can't read %s\n", path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		char primitive[64], input[64];
+		int payload;
+		double ns;
+		if (sscanf(line, "%63[^,],%63[^,],%d,%lf", primitive, input, &payload, &ns) == 4)
+		{
+			baseline[std::string(primitive) + "," + input + "," + std::to_string(payload)] = ns;
+		}
+	}
+	fclose(file);
+}
+
+int main(int argc, char ** argv)
+{
+	static const struct option options[] = {
+		{ "baseline", required_argument, 0, 'b' },
+		{ "capture", required_argument, 0, 'c' },
+		{ "filter", required_argument, 0, 'f' },
+		{ "time", required_argument, 0, 't' },
+		{ 0, 0, 0, 0 }
+	};
+	const char * capture = "debug_testmode.txt";
+	const char * kinds[] = { "random", "no_marker", "all_marker" };
+	const int payloads[] = { 0, 16, 64, 255 };
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", options, 0)) != -1)
+	{
+		switch (option)
+		{
+			case 'b':	readBaseline(optarg); break;
+			case 'c':	capture = optarg; break;
+			case 'f':	filter = optarg; break;
+			case 't':	seconds = atof(optarg); break;
+			default:
+				printf("usage: %s [--baseline FILE] [--capture FILE] [--filter NAME] [--time S]\n",
+				       argv[0]);
+				return 1;
+		}
+	}
+
+	srand(1);
+	printf("primitive,input,payload_bytes,ns_per_frame,ns_per_byte,tsc_cycles_per_frame%s\n",
+	       baseline.empty() ? "" : ",speedup");
+	for (int payload : payloads)
+	{
+		for (const char * kind : kinds)
+		{
+			if (payload == 0 && strcmp(kind, "random")) continue;	// All the same
+			input_t input = makeInput(kind, payload);
+			measureInput(input);
+		}
+	}
+	input_t captured = readCapture(capture);
+	if (!captured.frames.empty()) measureInput(captured);
+	measureDispatch();
+	return 0;
+}
@@ -13,10 +13,14 @@
  * Defines
  ****************************************************************************/
 #include "iProtocol.h"
+#include "CRC.h"
 
 /* Keeps running count of checksum mod 255. Used in computeMySum() */
 uint8_t checkDat = 0;
 
+/* Integrity mode of every address. All-zero is eIntegritySum */
+static integrity_mode_t integrity[256];
+
 /*******************************************************************************
 * Functions
 *******************************************************************************/
@@ -79,6 +83,159 @@ bool verifyChecksum(uint8_t* p) {
 	if ((uint8_t)sum != 0) return false;
 	else return true;
 }
+/* Function flow:
+ * --Sets/gets the integrity mode packets to and from a device use
+ */
+void setIntegrity(uint8_t address, integrity_mode_t mode)
+{
+	integrity[address] = mode;
+}
+
+integrity_mode_t getIntegrity(uint8_t address)
+{
+	return integrity[address];
+}
+
+/* Function flow:
+ * --Returns how many trailer bytes follow the payload in a mode
+ */
+size_t trailerSize(integrity_mode_t mode)
+{
+	switch (mode)
+	{
+		case eIntegrityCRC16:	return 2;
+		case eIntegrityCRC32C:	return 4;
+		default:				return 1;
+	}
+}
+
+/* Function flow:
+ * --Computes the trailer a packet should carry: the byte that makes the
+ *   packet sum to 0, or the CRC of the header + payload
+ *
+ * Function params:
+ * p:			The packet, header first. hdr->len must be filled in
+ * mode:		Integrity mode to compute
+ *
+ */
+uint32_t computeTrailer(const uint8_t * p, integrity_mode_t mode)
+{
+	const housekeeping_hdr_t * hdr = (const housekeeping_hdr_t *) p;
+	size_t size = sizeof(housekeeping_hdr_t) + hdr->len;
+	uint8_t sum = 0;
+
+	switch (mode)
+	{
+		case eIntegrityCRC16:	return CRC::crc16(p, size);
+		case eIntegrityCRC32C:	return CRC::crc32c(p, size);
+		default:
+			for (size_t i = 0; i < size; i++) sum -= p[i];
+			return sum;
+	}
+}
+
+/* Function flow:
+ * --Reads/writes the trailer after the payload, in the mode's byte order
+ *   (CRC-16 MSB first, CRC-32C LSB first, as each is usually sent)
+ *
+ */
+uint32_t readTrailer(const uint8_t * p, integrity_mode_t mode)
+{
+	const housekeeping_hdr_t * hdr = (const housekeeping_hdr_t *) p;
+	const uint8_t * t = p + sizeof(housekeeping_hdr_t) + hdr->len;
+
+	switch (mode)
+	{
+		case eIntegrityCRC16:	return (uint32_t)t[0] << 8 | t[1];
+		case eIntegrityCRC32C:
+			return (uint32_t)t[0] | (uint32_t)t[1] << 8 | (uint32_t)t[2] << 16 | (uint32_t)t[3] << 24;
+		default:				return t[0];
+	}
+}
+
+void writeTrailer(uint8_t * p, integrity_mode_t mode, uint32_t value)
+{
+	housekeeping_hdr_t * hdr = (housekeeping_hdr_t *) p;
+	uint8_t * t = p + sizeof(housekeeping_hdr_t) + hdr->len;
+
+	switch (mode)
+	{
+		case eIntegrityCRC16:
+			t[0] = value >> 8;
+			t[1] = value;
+			break;
+		case eIntegrityCRC32C:
+			t[0] = value;
+			t[1] = value >> 8;
+			t[2] = value >> 16;
+			t[3] = value >> 24;
+			break;
+		default:
+			t[0] = value;
+			break;
+	}
+}
+
+/* Function flow:
+ * --Fills in the trailer of an outgoing packet
+ * --Returns the packet's size, header to trailer, i.e. what to send
+ *
+ */
+size_t fillTrailer(uint8_t * p, integrity_mode_t mode)
+{
+	housekeeping_hdr_t * hdr = (housekeeping_hdr_t *) p;
+
+	writeTrailer(p, mode, computeTrailer(p, mode));
+	return sizeof(housekeeping_hdr_t) + hdr->len + trailerSize(mode);
+}
+
+bool verifyTrailer(const uint8_t * p, integrity_mode_t mode)
+{
+	return readTrailer(p, mode) == computeTrailer(p, mode);
+}
+
+/* Function flow:
+ * --Checks a decoded packet in one go, from what was gathered while it was
+ *   decoded: its size and the sum of all its bytes
+ * --A packet has to be long enough for a header + trailer, and hdr->len has
+ *   to account for every byte in between. The trailer size is the one of
+ *   the source's integrity mode. Only then can the trailer and the
+ *   destination be trusted
+ * --In sum mode the decoder's sum is the whole check. A CRC trailer is
+ *   checked with one CRC pass over the header + payload
+ * --Returns ePacketOK, or the first thing wrong with the packet
+ *
+ * Function params:
+ * p:			The decoded packet
+ * size:		Size of the decoded packet
+ * sum:			Sum mod 256 of all size bytes, checksum included
+ * address:		Our address: only packets for it are accepted, as the
+ *				host's checkHdr() always did. eBroadcast accepts any
+ *				destination
+ *
+ */
+packet_status_t checkPacket(const uint8_t * p, size_t size, uint8_t sum, uint8_t address)
+{
+	const housekeeping_hdr_t * hdr = (const housekeeping_hdr_t *) p;
+
+	if (size < sizeof(housekeeping_hdr_t)) return ePacketBadLength;
+
+	integrity_mode_t mode = integrity[hdr->src];
+	if (size != sizeof(housekeeping_hdr_t) + hdr->len + trailerSize(mode))
+	{
+		return ePacketBadLength;
+	}
+	if (mode == eIntegritySum ? sum != 0 : !verifyTrailer(p, mode))
+	{
+		return ePacketBadChecksum;
+	}
+	if (address != eBroadcast && hdr->dst != address)
+	{
+		return ePacketBadDest;
+	}
+	return ePacketOK;
+}
+
 /* Function flow:
  * --Checks if a device address is inside a given array of addresses
  * --If the device is known (within the list), function returns its location
@@ -12,6 +12,7 @@
  * Defines
  ****************************************************************************/
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 /* Standard error types */
@@ -69,6 +70,28 @@ typedef enum housekeeping_prio_type
 
 
 
+/* Integrity check carried in a packet's trailer. Each device is set to one
+ * (setIntegrity); both ends have to agree */
+typedef enum integrity_mode
+{
+	eIntegritySum = 0,		// 1 byte: bytes sum to 0 mod 256 (default)
+	eIntegrityCRC16 = 1,	// 2 bytes: CRC-16/CCITT, MSB first
+	eIntegrityCRC32C = 2	// 4 bytes: CRC-32C, LSB first
+} integrity_mode_t;
+
+/* Largest trailer, for sizing packet buffers */
+#define MAX_TRAILER_LENGTH 4
+
+/* What checkPacket() found wrong with a received packet, if anything */
+typedef enum packet_status
+{
+	ePacketOK = 0,
+	ePacketBadChecksum = 1,	// Trailer doesn't match (sum or CRC)
+	ePacketBadLength = 2,	// hdr->len doesn't match the decoded size
+	ePacketBadDest = 3		// Meant for somebody else
+} packet_status_t;
+
+
 /*******************************************************************************
 * Typedef structs
 *******************************************************************************/
@@ -110,15 +133,25 @@ typedef struct housekeeping_prio_t
 void fillChecksum(uint8_t* p);
 bool verifyChecksum(uint8_t * p);
 
+/* Integrity mode of each device, by address. Packets from a device are
+ * checked, and packets to it filled, with its mode */
+void setIntegrity(uint8_t address, integrity_mode_t mode);
+integrity_mode_t getIntegrity(uint8_t address);
 
-/* Find address in an array of addresses */
-uint8_t * findMe(uint8_t * first, uint8_t * last, uint8_t address);
+/* Trailers of any mode. p is the packet, starting at its header; the trailer
+ * goes right after the hdr->len payload bytes */
+size_t trailerSize(integrity_mode_t mode);
+uint32_t computeTrailer(const uint8_t * p, integrity_mode_t mode);
+uint32_t readTrailer(const uint8_t * p, integrity_mode_t mode);
+void writeTrailer(uint8_t * p, integrity_mode_t mode, uint32_t value);
+size_t fillTrailer(uint8_t * p, integrity_mode_t mode);	// Returns the packet's size
+bool verifyTrailer(const uint8_t * p, integrity_mode_t mode);
 
+/* Checks a decoded packet whose byte sum is already known (the COBS decoder
+ * adds it up while decoding, see COBSDecoder::frameSum), without reading
+ * the payload again */
+packet_status_t checkPacket(const uint8_t * p, size_t size, uint8_t sum, uint8_t address);
 
-/*******************************************************************************
-* Defines - global variables
-*******************************************************************************/
-extern housekeeping_hdr_t * hdr_in;		// pointer for loc of incoming data header
-extern housekeeping_hdr_t * hdr_out;	// pointer for loc of outgoing header
-extern housekeeping_err_t * hdr_err;	// pointer for loc of error header
-extern housekeeping_prio_t * hdr_prio;	// pointer for loc of priority header
+
+/* Find address in an array of addresses */
+uint8_t * findMe(uint8_t * first, uint8_t * last, uint8_t address);
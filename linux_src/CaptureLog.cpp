@@ -0,0 +1,365 @@
+/*
+ * CaptureLog.cpp
+ *
+ * Defines the CaptureLog and CaptureReader classes.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "CaptureLog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Bytes a record of a frame takes in the file, padding included */
+static inline size_t recordBytes(size_t size)
+{
+	return (sizeof(capture_record_t) + size + CAPTURE_ALIGN - 1) & ~(size_t)(CAPTURE_ALIGN - 1);
+}
+
+static inline uint64_t clockNs(clockid_t clock)
+{
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+capture_time_t captureTime()
+{
+	capture_time_t time;
+
+	time.monotonic = clockNs(CLOCK_MONOTONIC);
+	time.realtime = clockNs(CLOCK_REALTIME);
+	return time;
+}
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+CaptureLog::CaptureLog()
+	: _fd(-1), _buffer(0), _used(0), _buffered(0), _frames(0), _dropped(0), _bytes(0)
+{
+}
+
+CaptureLog::~CaptureLog()
+{
+	close();
+}
+
+CaptureReader::CaptureReader()
+	: _map(0), _size(0), _offset(0), _truncated(false)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+	close();
+}
+
+/*****************************************************************************
+ * CaptureLog functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Opens the file for appending, making it if it doesn't exist
+ * --A new (empty) file gets the header. An existing one must be a log of
+ *   this version; a record cut short at its end (a crash) is cut off, so
+ *   the records appended after it can be read
+ * --Returns FALSE, with the reason printed, if the log can't be used
+ *
+ * Function params:
+ * path:		File to append to
+ *
+ */
+bool CaptureLog::open(const char * path)
+{
+	struct stat status;
+
+	close();
+	_frames = _dropped = _bytes = 0;
+	_buffer = new (std::nothrow) uint8_t[CAPTURE_BUFFER];
+	_fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (!_buffer || _fd < 0 || fstat(_fd, &status) < 0)
+	{
+		printf("ERROR, could not open capture log %s: %s\n", path, strerror(errno));
+		close();
+		return false;
+	}
+
+	if (status.st_size == 0)
+	{
+		capture_file_hdr_t header;
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+		header.version = CAPTURE_VERSION;
+		header.headerSize = sizeof(capture_file_hdr_t);
+		header.recordSize = sizeof(capture_record_t);
+		header.created = clockNs(CLOCK_REALTIME);
+		if (!write(&header, sizeof(header)))
+		{
+			ftruncate(_fd, 0);
+			close();
+			return false;
+		}
+		_bytes = sizeof(header);
+	}
+	else
+	{
+		CaptureReader reader;
+
+		if (!reader.open(path))
+		{
+			printf("ERROR, %s is not a capture log\n", path);
+			close();
+			return false;
+		}
+		while (reader.next()) ;
+		_bytes = reader.validEnd();
+		if (reader.truncated() && ftruncate(_fd, _bytes) < 0)
+		{
+			printf("ERROR, could not cut the last record off %s: %s\n", path, strerror(errno));
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Writes what is left in the buffer, then closes the file */
+void CaptureLog::close()
+{
+	if (_fd >= 0) sync();
+	if (_fd >= 0) ::close(_fd);
+	_fd = -1;
+	delete[] _buffer;
+	_buffer = 0;
+	_used = 0;
+	_buffered = 0;
+}
+
+bool CaptureLog::isOpen() const
+{
+	return _fd >= 0;
+}
+
+void CaptureLog::record(const uint8_t * frame, size_t size, uint8_t port,
+                        capture_direction_t direction, uint8_t status)
+{
+	if (_fd < 0) return;
+	record(frame, size, port, direction, status, captureTime());
+}
+
+/* Function flow:
+ * --Writes the buffer out first if the record won't fit in what's left
+ * --Stamps the record with the time given, then copies it and the frame
+ *   into the buffer, padded to CAPTURE_ALIGN
+ *
+ * Function params:
+ * frame:		The decoded frame, header to trailer
+ * size:		Its size (at most 65535 bytes)
+ * port:		Index of the port it went through
+ * direction:	eCaptureRx or eCaptureTx
+ * status:		What checkPacket() found, for a received frame
+ * time:		When it was sent or decoded (captureTime())
+ *
+ */
+void CaptureLog::record(const uint8_t * frame, size_t size, uint8_t port,
+                        capture_direction_t direction, uint8_t status,
+                        const capture_time_t & time)
+{
+	if (_fd < 0 || size > UINT16_MAX) return;
+
+	size_t bytes = recordBytes(size);
+	if (_used + bytes > CAPTURE_BUFFER) flush();
+
+	capture_record_t * record = (capture_record_t *)(_buffer + _used);
+	record->monotonic = time.monotonic;
+	record->realtime = time.realtime;
+	record->size = size;
+	record->port = port;
+	record->direction = direction;
+	record->status = status;
+	memset(record->reserved, 0, sizeof(record->reserved));
+	memcpy(record + 1, frame, size);
+	memset((uint8_t *)(record + 1) + size, 0, bytes - sizeof(capture_record_t) - size);
+
+	_used += bytes;
+	_bytes += bytes;
+	_buffered++;
+	_frames++;
+}
+
+/* Function flow:
+ * --Writes the whole buffer to the file
+ * --If the write fails, the buffered frames are counted as dropped and the
+ *   buffer is emptied all the same, so the log keeps going. Whatever part
+ *   of the buffer did reach the file is cut off again, so the next records
+ *   start where a record ended; if that fails too, the log is closed
+ *
+ */
+bool CaptureLog::flush()
+{
+	if (_fd < 0 || _used == 0) return true;
+
+	bool written = write(_buffer, _used);
+	if (!written)
+	{
+		_dropped += _buffered;
+		_bytes -= _used;
+		if (ftruncate(_fd, _bytes) < 0)
+		{
+			printf("ERROR, could not cut a partial write off the capture log, "
+			       "closing it: %s\n", strerror(errno));
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+	_used = 0;
+	_buffered = 0;
+	return written;
+}
+
+bool CaptureLog::sync()
+{
+	bool written = flush();
+
+	return _fd >= 0 && fdatasync(_fd) == 0 && written;
+}
+
+/* write() until it has all gone, or fails */
+bool CaptureLog::write(const void * data, size_t size)
+{
+	const uint8_t * next = (const uint8_t *) data;
+
+	while (size > 0)
+	{
+		ssize_t written = ::write(_fd, next, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0)
+		{
+			printf("ERROR, could not write the capture log: %s\n", strerror(errno));
+			return false;
+		}
+		next += written;
+		size -= written;
+	}
+	return true;
+}
+
+uint64_t CaptureLog::frames() const
+{
+	return _frames;
+}
+
+uint64_t CaptureLog::dropped() const
+{
+	return _dropped;
+}
+
+uint64_t CaptureLog::bytes() const
+{
+	return _bytes;
+}
+
+/*****************************************************************************
+ * CaptureReader functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Maps the whole file read-only
+ * --Returns FALSE if it can't, or if the header isn't a log of this version
+ *
+ */
+bool CaptureReader::open(const char * path)
+{
+	struct stat status;
+	int fd;
+
+	close();
+	fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	if (fstat(fd, &status) < 0 || (size_t) status.st_size < sizeof(capture_file_hdr_t))
+	{
+		::close(fd);
+		return false;
+	}
+
+	void * map = mmap(0, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) return false;
+	_map = (const uint8_t *) map;
+	_size = status.st_size;
+
+	const capture_file_hdr_t * hdr = header();
+	if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CAPTURE_VERSION || hdr->headerSize != sizeof(capture_file_hdr_t) ||
+	    hdr->recordSize != sizeof(capture_record_t))
+	{
+		close();
+		return false;
+	}
+	rewind();
+	madvise(map, _size, MADV_SEQUENTIAL);
+	return true;
+}
+
+void CaptureReader::close()
+{
+	if (_map) munmap((void *) _map, _size);
+	_map = 0;
+	_size = 0;
+	_offset = 0;
+	_truncated = false;
+}
+
+const capture_file_hdr_t * CaptureReader::header() const
+{
+	return (const capture_file_hdr_t *) _map;
+}
+
+/* Function flow:
+ * --Returns the record at the current offset and moves past it
+ * --Returns 0 at the end of the file, or if the record there runs past it
+ *   (the writer crashed mid-record), which sets truncated()
+ *
+ */
+const capture_record_t * CaptureReader::next()
+{
+	if (!_map || _offset >= _size) return 0;
+
+	const capture_record_t * record = (const capture_record_t *)(_map + _offset);
+	if (_size - _offset < sizeof(capture_record_t) || _size - _offset < recordBytes(record->size))
+	{
+		_truncated = true;
+		return 0;
+	}
+	_offset += recordBytes(record->size);
+	return record;
+}
+
+void CaptureReader::rewind()
+{
+	_offset = sizeof(capture_file_hdr_t);
+	_truncated = false;
+}
+
+size_t CaptureReader::validEnd() const
+{
+	return _offset;
+}
+
+bool CaptureReader::truncated() const
+{
+	return _truncated;
+}
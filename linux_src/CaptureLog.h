@@ -0,0 +1,158 @@
+/*
+ * CaptureLog.h
+ *
+ * Declares the capture log: an append-only binary file of every frame the
+ * host sends or decodes, for keeping a record of a run without printing it
+ * (compare debug_testmode.txt). Each record holds the decoded frame, the
+ * port it went through, its direction, what checkPacket() found, and when:
+ * CLOCK_MONOTONIC for ordering and intervals, CLOCK_REALTIME to line it up
+ * with other logs.
+ *
+ * Records are copied into a CAPTURE_BUFFER byte buffer, which goes to the
+ * file with one write() when it fills. Recording a frame is a memcpy and
+ * two clock reads (vDSO, no system call), cheap enough to leave on at full
+ * line rate. sync() writes what is buffered and fdatasync()s the file: the
+ * owner calls it every CAPTURE_SYNC seconds (see main.cpp), so a crash loses
+ * at most that much.
+ *
+ * File layout, in host byte order:
+ *	capture_file_hdr_t
+ *	capture_record_t, its frame, zero padding to CAPTURE_ALIGN bytes
+ *	capture_record_t, ...
+ * A record cut short by a crash is cut off when the log is opened again.
+ *
+ * CaptureReader maps a log and walks its records.
+ *
+ * Not thread safe: PortManager records from the main loop only. A frame
+ * decoded on the reader thread is stamped there (captureTime()) and
+ * recorded with that time, so its record says when it arrived, not when
+ * the main loop got to it.
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* define CAPTURE_MAGIC for the first 8 bytes of a log */
+#define CAPTURE_MAGIC "HSKCAP\r\n"
+/* define CAPTURE_VERSION for the layout below */
+#define CAPTURE_VERSION 1
+/* define CAPTURE_BUFFER for the bytes kept before a write() */
+#define CAPTURE_BUFFER (1 << 20)
+/* define CAPTURE_ALIGN for the alignment of every record in the file */
+#define CAPTURE_ALIGN 8
+
+/* Which way a frame went */
+typedef enum capture_direction
+{
+	eCaptureRx = 0,		// Decoded from a port
+	eCaptureTx = 1		// Queued on a port
+} capture_direction_t;
+
+/* Start of every log */
+typedef struct capture_file_hdr_t
+{
+	char magic[8];			// CAPTURE_MAGIC
+	uint16_t version;		// CAPTURE_VERSION
+	uint16_t headerSize;	// sizeof(capture_file_hdr_t)
+	uint16_t recordSize;	// sizeof(capture_record_t)
+	uint16_t reserved;
+	uint64_t created;		// CLOCK_REALTIME, ns
+} capture_file_hdr_t;
+
+/* Start of every record. The frame follows */
+typedef struct capture_record_t
+{
+	uint64_t monotonic;		// CLOCK_MONOTONIC, ns
+	uint64_t realtime;		// CLOCK_REALTIME, ns
+	uint16_t size;			// Bytes of the frame
+	uint8_t port;			// PortManager's index of the port
+	uint8_t direction;		// capture_direction_t
+	uint8_t status;			// packet_status_t of a received frame, 0 if sent
+	uint8_t reserved[3];
+} capture_record_t;
+
+static_assert(sizeof(capture_file_hdr_t) % CAPTURE_ALIGN == 0, "header breaks alignment");
+static_assert(sizeof(capture_record_t) % CAPTURE_ALIGN == 0, "record breaks alignment");
+
+/* When a frame was sent or decoded */
+typedef struct capture_time_t
+{
+	uint64_t monotonic;		// CLOCK_MONOTONIC, ns
+	uint64_t realtime;		// CLOCK_REALTIME, ns
+} capture_time_t;
+
+/* Both clocks, now */
+capture_time_t captureTime();
+
+/* The frame of a record */
+inline const uint8_t * captureFrame(const capture_record_t * record)
+{
+	return (const uint8_t *)(record + 1);
+}
+
+class CaptureLog
+{
+public:
+CaptureLog();
+~CaptureLog();
+
+/* Opens a log for appending, making it if it doesn't exist. Returns FALSE
+ * if it can't, or if the file isn't a log */
+bool open(const char * path);
+void close();
+bool isOpen() const;
+
+/* Appends a frame, stamped with the time now, or with when it was decoded */
+void record(const uint8_t * frame, size_t size, uint8_t port,
+            capture_direction_t direction, uint8_t status = 0);
+void record(const uint8_t * frame, size_t size, uint8_t port,
+            capture_direction_t direction, uint8_t status, const capture_time_t & time);
+
+/* Writes the buffer out. sync() also waits for it to reach the disk */
+bool flush();
+bool sync();
+
+uint64_t frames() const;	// Recorded since open()
+uint64_t dropped() const;	// Lost to failed writes
+uint64_t bytes() const;		// Size of the log, buffer included
+
+private:
+bool write(const void * data, size_t size);
+
+int _fd;
+uint8_t * _buffer;
+size_t _used;
+uint64_t _buffered;		// Frames in the buffer
+uint64_t _frames;
+uint64_t _dropped;
+uint64_t _bytes;
+};
+
+class CaptureReader
+{
+public:
+CaptureReader();
+~CaptureReader();
+
+/* Maps a log. Returns FALSE if it can't, or if the file isn't a log */
+bool open(const char * path);
+void close();
+const capture_file_hdr_t * header() const;
+
+/* The next record, or 0 at the end of the log or of its last whole record */
+const capture_record_t * next();
+void rewind();
+
+/* Offset just past the last whole record read so far */
+size_t validEnd() const;
+/* TRUE once next() has stopped at a record cut short */
+bool truncated() const;
+
+private:
+const uint8_t * _map;
+size_t _size;
+size_t _offset;
+bool _truncated;
+};
@@ -0,0 +1,319 @@
+/*
+ * EventLoop_linux.cpp
+ *
+ * Defines the EventLoop class: an epoll set of file descriptors and timerfd
+ * timers, each with the function that handles it.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "EventLoop_linux.h"
+
+#include <stdio.h>
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+/* Function flow:
+ * --Creates the epoll instance and marks every watch slot free
+ * --Watches an eventfd so stop() can wake the loop from another thread
+ * --If epoll can't be created, spit out an error. isValid() reports it
+ *
+ */
+EventLoop::EventLoop()
+	: stopping(false)
+{
+	for (int i = 0; i < MAX_WATCHES; i++)
+	{
+		watches[i].fd = -1;
+	}
+
+	this->wakeHandle = -1;
+	this->epollHandle = epoll_create1(EPOLL_CLOEXEC);
+	if (this->epollHandle < 0)
+	{
+		printf ("error %d creating epoll instance: %s\n", errno, strerror (errno));
+		return;
+	}
+
+	this->wakeHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = 0;
+	epoll_ctl(this->epollHandle, EPOLL_CTL_ADD, this->wakeHandle, &event);
+}
+
+/* Define the destructor to close the timers and the epoll instance. Watched
+ * fds belong to whoever added them and are left open */
+EventLoop::~EventLoop()
+{
+	for (int i = 0; i < MAX_WATCHES; i++)
+	{
+		if (watches[i].fd >= 0 && watches[i].isTimer)
+		{
+			close(watches[i].fd);
+		}
+	}
+	if (this->wakeHandle >= 0)
+	{
+		close(this->wakeHandle);
+	}
+	if (this->epollHandle >= 0)
+	{
+		close(this->epollHandle);
+	}
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Returns the watch slot for fd, or 0 if fd isn't watched
+ */
+EventLoop::Watch * EventLoop::findWatch(int fd)
+{
+	for (int i = 0; i < MAX_WATCHES; i++)
+	{
+		if (watches[i].fd == fd) return &watches[i];
+	}
+	return 0;
+}
+
+/* Function flow:
+ * --Takes a free watch slot and adds fd to the epoll set, pointing at it
+ * --Returns the slot, or 0 if there is no free slot or epoll refuses
+ *
+ * Function params:
+ * fd:			File descriptor to watch
+ * events:		EPOLLIN, EPOLLOUT, ... to wait for
+ * context:		Handed back to the handler untouched
+ *
+ */
+EventLoop::Watch * EventLoop::addWatch(int fd, uint32_t events, void * context)
+{
+	Watch * watch = findWatch(-1);
+	if (fd < 0 || watch == 0 || findWatch(fd)) return 0;
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = watch;
+
+	if (epoll_ctl(this->epollHandle, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		printf ("error %d watching fd %d: %s\n", errno, fd, strerror (errno));
+		return 0;
+	}
+
+	watch->fd = fd;
+	watch->isTimer = false;
+	watch->FdReadyFunction = 0;
+	watch->TimerExpiredFunction = 0;
+	watch->context = context;
+	return watch;
+}
+
+/* Function flow:
+ * --Takes fd out of the epoll set and frees its slot
+ */
+void EventLoop::removeWatch(int fd)
+{
+	Watch * watch = findWatch(fd);
+	if (fd < 0 || watch == 0) return;
+
+	epoll_ctl(this->epollHandle, EPOLL_CTL_DEL, fd, 0);
+	watch->fd = -1;
+}
+
+/* Function flow:
+ * --Calls FdReadyFunction whenever fd is ready for one of the events
+ * --Returns FALSE if the fd couldn't be watched
+ *
+ * Function params:
+ * fd:					File descriptor to watch (a SerialPort's handle, ...)
+ * events:				EPOLLIN, EPOLLOUT, ... to wait for
+ * FdReadyFunction:		user-defined function location in memory
+ * context:				Handed back to FdReadyFunction untouched
+ *
+ */
+bool EventLoop::addFd(int fd, uint32_t events, FdHandlerFunction FdReadyFunction,
+                      void * context)
+{
+	Watch * watch = addWatch(fd, events, context);
+	if (watch == 0) return false;
+
+	watch->FdReadyFunction = FdReadyFunction;
+	return true;
+}
+
+/* Function flow:
+ * --Changes the events a watched fd is waited on for
+ */
+bool EventLoop::modifyFd(int fd, uint32_t events)
+{
+	Watch * watch = findWatch(fd);
+	if (fd < 0 || watch == 0) return false;
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = watch;
+	return epoll_ctl(this->epollHandle, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void EventLoop::removeFd(int fd)
+{
+	removeWatch(fd);
+}
+
+/* Function flow:
+ * --Creates a monotonic timerfd and watches it. The timer starts disarmed
+ * --Returns the timer, or -1 if it couldn't be created
+ *
+ * Function params:
+ * TimerExpiredFunction:	user-defined function location in memory
+ * context:					Handed back to TimerExpiredFunction untouched
+ *
+ */
+int EventLoop::addTimer(TimerHandlerFunction TimerExpiredFunction, void * context)
+{
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0)
+	{
+		printf ("error %d creating timer: %s\n", errno, strerror (errno));
+		return -1;
+	}
+
+	Watch * watch = addWatch(timer, EPOLLIN, context);
+	if (watch == 0)
+	{
+		close(timer);
+		return -1;
+	}
+
+	watch->isTimer = true;
+	watch->TimerExpiredFunction = TimerExpiredFunction;
+	return timer;
+}
+
+/* Function flow:
+ * --(Re)starts a timer. It expires once after 'seconds', then every
+ *   'interval' seconds if interval is nonzero
+ *
+ * Function params:
+ * timer:		Timer returned by addTimer()
+ * seconds:		Time until the first expiry. 0 disarms the timer
+ * interval:	Period after the first expiry, 0 for a one-shot
+ *
+ */
+void EventLoop::armTimer(int timer, double seconds, double interval)
+{
+	struct itimerspec spec;
+
+	/* timerfd treats an all-zero it_value as 'disarm', so round up to 1 ns */
+	if (seconds > 0 && seconds < 1e-9) seconds = 1e-9;
+
+	spec.it_value.tv_sec = (time_t)seconds;
+	spec.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+	spec.it_interval.tv_sec = (time_t)interval;
+	spec.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+
+	timerfd_settime(timer, 0, &spec, 0);
+}
+
+void EventLoop::disarmTimer(int timer)
+{
+	armTimer(timer, 0, 0);
+}
+
+void EventLoop::removeTimer(int timer)
+{
+	if (timer < 0) return;
+	removeWatch(timer);
+	close(timer);
+}
+
+/* Function flow:
+ * --Sleeps until something is ready or timeout_ms passes (-1: no timeout)
+ * --Calls the handler of everything that is ready. Timers are read first so
+ *   they don't fire again on the next wait
+ * --Returns the number of handlers called, or -1 on an epoll error
+ *
+ * Function variables:
+ * events:		What epoll_wait reported ready, up to MAX_WATCHES of them
+ *
+ */
+int EventLoop::runOnce(int timeout_ms)
+{
+	struct epoll_event events[MAX_WATCHES];
+	int numReady = epoll_wait(this->epollHandle, events, MAX_WATCHES, timeout_ms);
+
+	if (numReady < 0)
+	{
+		/* A signal isn't an error, just an early wake up */
+		if (errno == EINTR) return 0;
+		printf ("error %d waiting for events: %s\n", errno, strerror (errno));
+		return -1;
+	}
+
+	for (int i = 0; i < numReady; i++)
+	{
+		Watch * watch = (Watch *) events[i].data.ptr;
+
+		/* stop() woke us up */
+		if (watch == 0)
+		{
+			uint64_t wakes;
+			read(this->wakeHandle, &wakes, sizeof(wakes));
+			continue;
+		}
+
+		/* Removed by an earlier handler in this batch */
+		if (watch->fd < 0) continue;
+
+		if (watch->isTimer)
+		{
+			uint64_t expirations;
+			if (read(watch->fd, &expirations, sizeof(expirations)) > 0
+			    && watch->TimerExpiredFunction)
+			{
+				watch->TimerExpiredFunction(watch->context, watch->fd);
+			}
+		}
+		else if (watch->FdReadyFunction)
+		{
+			watch->FdReadyFunction(watch->context, watch->fd, events[i].events);
+		}
+	}
+	return numReady;
+}
+
+/* Function flow:
+ * --Handles events until stop() is called or epoll fails. A stop() that
+ *   comes in before run() starts still counts
+ */
+void EventLoop::run()
+{
+	while (!this->stopping.exchange(false))
+	{
+		if (runOnce(-1) < 0) break;
+	}
+}
+
+/* Function flow:
+ * --Makes run() return once the current batch of handlers is done. Wakes
+ *   epoll_wait in case the loop is running on another thread
+ */
+void EventLoop::stop()
+{
+	uint64_t wake = 1;
+
+	this->stopping = true;
+	if (this->wakeHandle >= 0) write(this->wakeHandle, &wake, sizeof(wake));
+}
+
+bool EventLoop::isValid()
+{
+	return this->epollHandle >= 0;
+}
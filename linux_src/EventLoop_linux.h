@@ -0,0 +1,70 @@
+/*
+ * EventLoop_linux.h
+ *
+ * Small epoll event loop for Linux. Sleeps until a watched file descriptor
+ * (e.g. a serial port) is ready or a timer (timerfd) expires, then calls the
+ * handler registered for it.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+/* define MAX_WATCHES for the most fds + timers one loop can watch */
+#define MAX_WATCHES 64
+
+class EventLoop
+{
+public:
+EventLoop();
+~EventLoop();
+
+/* typedefs for fd-ready and timer-expired functions */
+typedef void (*FdHandlerFunction)(void * context, int fd, uint32_t events);
+typedef void (*TimerHandlerFunction)(void * context, int timer);
+
+/* Watching file descriptors */
+bool addFd(int fd, uint32_t events, FdHandlerFunction FdReadyFunction, void * context);
+bool modifyFd(int fd, uint32_t events);
+void removeFd(int fd);
+
+/* Timers. The returned timer is a timerfd, or -1 on failure */
+int addTimer(TimerHandlerFunction TimerExpiredFunction, void * context);
+void armTimer(int timer, double seconds, double interval = 0);
+void disarmTimer(int timer);
+void removeTimer(int timer);
+
+/* Running the loop */
+int runOnce(int timeout_ms = -1);
+void run();
+void stop();	// Safe to call from another thread
+bool isValid();
+
+private:
+/* One watched fd or timer. epoll hands back a pointer to it */
+struct Watch
+{
+	int fd;
+	bool isTimer;
+	FdHandlerFunction FdReadyFunction;
+	TimerHandlerFunction TimerExpiredFunction;
+	void * context;
+};
+
+Watch * findWatch(int fd);
+Watch * addWatch(int fd, uint32_t events, void * context);
+void removeWatch(int fd);
+
+int epollHandle;
+int wakeHandle;		// eventfd that stop() writes to, to end epoll_wait early
+std::atomic<bool> stopping;	// Set by stop(), cleared when run() returns
+
+Watch watches[MAX_WATCHES];
+};
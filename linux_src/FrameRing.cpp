@@ -0,0 +1,117 @@
+/*
+ * FrameRing.cpp
+ *
+ * Defines the FrameRing class. head counts packets pushed, tail counts
+ * packets popped; both only ever grow, and slot = count & mask.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "FrameRing.h"
+
+#include <string.h>
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+/* Function flow:
+ * --Allocates the slots. depth is rounded up to a power of 2 so the slot
+ *   index is a mask instead of a division
+ *
+ * Function params:
+ * depth:		Most packets the ring holds before push() starts dropping
+ *
+ */
+FrameRing::FrameRing(size_t depth)
+	: head(0), tail(0), _highWater(0), _pushed(0), _overflows(0)
+{
+	size_t size = 1;
+	while (size < depth) size <<= 1;
+
+	this->slots = new frame_slot_t[size];
+	this->mask = size - 1;
+}
+
+FrameRing::~FrameRing()
+{
+	delete[] this->slots;
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Copies a decoded packet into the next free slot and publishes it
+ * --If the consumer has fallen a whole ring behind, the packet is dropped
+ *   and counted as an overflow
+ * --Returns TRUE if the packet was queued
+ *
+ * Function params:
+ * buffer:		The decoded packet
+ * size:		Size of the decoded packet (at most MAX_PACKET_LENGTH)
+ * port:		Index of the port it arrived on
+ * sum:			Byte sum of the packet (see COBSDecoder::frameSum)
+ * time:		When it was decoded (captureTime())
+ *
+ */
+bool FrameRing::push(const uint8_t * buffer, size_t size, uint8_t port, uint8_t sum,
+                     const capture_time_t & time)
+{
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t used = h - tail.load(std::memory_order_acquire);
+
+	if (used > mask || size > MAX_PACKET_LENGTH)
+	{
+		_overflows.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	frame_slot_t * slot = &slots[h & mask];
+	slot->size = size;
+	slot->port = port;
+	slot->sum = sum;
+	slot->time = time;
+	memcpy(slot->data, buffer, size);
+
+	head.store(h + 1, std::memory_order_release);
+
+	_pushed.fetch_add(1, std::memory_order_relaxed);
+	if (used + 1 > _highWater.load(std::memory_order_relaxed))
+		_highWater.store(used + 1, std::memory_order_relaxed);
+	return true;
+}
+
+/* Function flow:
+ * --Returns the oldest queued packet without removing it, or 0 if the ring
+ *   is empty. The slot stays valid until pop()
+ *
+ */
+const frame_slot_t * FrameRing::front()
+{
+	size_t t = tail.load(std::memory_order_relaxed);
+
+	if (t == head.load(std::memory_order_acquire)) return 0;
+	return &slots[t & mask];
+}
+
+/* Function flow:
+ * --Hands the oldest slot back to the producer
+ */
+void FrameRing::pop()
+{
+	size_t t = tail.load(std::memory_order_relaxed);
+	tail.store(t + 1, std::memory_order_release);
+}
+
+/* Function flow:
+ * --Returns how many packets are waiting. Only a snapshot when read from the
+ *   other thread
+ *
+ */
+size_t FrameRing::count() const
+{
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
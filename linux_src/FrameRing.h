@@ -0,0 +1,63 @@
+/*
+ * FrameRing.h
+ *
+ * Lock-free single-producer/single-consumer ring of decoded packets. The
+ * reader thread pushes each packet it decodes into the next free slot; the
+ * main thread pops them and runs the packet handler.
+ *
+ */
+#pragma once
+
+#include "SerialPort_linux.h"
+#include "CaptureLog.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* One decoded packet, the index of the port it arrived on, the byte sum
+ * the decoder added up for it, and when it was decoded */
+typedef struct frame_slot_t
+{
+	capture_time_t time;
+	uint16_t size;
+	uint8_t port;
+	uint8_t sum;
+	uint8_t data[MAX_PACKET_LENGTH];
+} frame_slot_t;
+
+class FrameRing
+{
+public:
+FrameRing(size_t depth);
+~FrameRing();
+
+/* Producer side: only the reader thread calls these */
+bool push(const uint8_t * buffer, size_t size, uint8_t port, uint8_t sum,
+          const capture_time_t & time);
+
+/* Consumer side: only the main thread calls these */
+const frame_slot_t * front();
+void pop();
+
+/* Safe to read from either thread */
+size_t depth() const { return mask + 1; }
+size_t count() const;
+size_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+uint64_t pushed() const { return _pushed.load(std::memory_order_relaxed); }
+uint64_t overflows() const { return _overflows.load(std::memory_order_relaxed); }
+
+private:
+frame_slot_t * slots;
+size_t mask;
+
+/* head is only written by the producer, tail only by the consumer. Each sits
+ * on its own cache line so the two threads don't fight over it */
+alignas(64) std::atomic<size_t> head;
+alignas(64) std::atomic<size_t> tail;
+
+/* Producer-side statistics */
+alignas(64) std::atomic<size_t> _highWater;
+std::atomic<uint64_t> _pushed;
+std::atomic<uint64_t> _overflows;
+};
@@ -0,0 +1,274 @@
+/*
+ * IoUring_linux.cpp
+ *
+ * Defines the IoUring class: sets up the rings with io_uring_setup(), maps
+ * them, and fills/drains them with the memory ordering the kernel expects
+ * (acquire on the index the kernel writes, release on the one we write).
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+/* Built only where PortManager_linux.h turns io_uring on */
+#if !defined(HSK_NO_IO_URING) && __has_include(<linux/io_uring.h>)
+#include "IoUring_linux.h"
+
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+/* Function flow:
+ * --Creates the ring with room for 'entries' requests in flight
+ * --Maps the submission queue, completion queue and SQE array
+ * --Registers an eventfd the kernel signals on every completion
+ * --If any step fails, spit out an error. isValid() reports it, and callers
+ *   fall back to plain read()/write()
+ *
+ */
+IoUring::IoUring(unsigned entries)
+{
+	struct io_uring_params params;
+
+	this->eventHandle = -1;
+	this->sqRing = MAP_FAILED;
+	this->cqRing = MAP_FAILED;
+	this->sqes = (struct io_uring_sqe *) MAP_FAILED;
+
+	memset(&params, 0, sizeof(params));
+	this->ringHandle = syscall(__NR_io_uring_setup, entries, &params);
+	if (this->ringHandle < 0)
+	{
+		printf ("error %d setting up io_uring: %s\n", errno, strerror (errno));
+		return;
+	}
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Newer kernels put both queues in one mapping */
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+		cqRingSize = sqRingSize;
+	}
+
+	sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	              this->ringHandle, IORING_OFF_SQ_RING);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		cqRing = sqRing;
+	else
+		cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		              this->ringHandle, IORING_OFF_CQ_RING);
+
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe *) mmap(0, sqesSize, PROT_READ | PROT_WRITE,
+	                                    MAP_SHARED | MAP_POPULATE,
+	                                    this->ringHandle, IORING_OFF_SQES);
+
+	if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		printf ("error %d mapping io_uring: %s\n", errno, strerror (errno));
+		close(this->ringHandle);
+		this->ringHandle = -1;
+		return;
+	}
+
+	sqHead    = (unsigned *)((char *) sqRing + params.sq_off.head);
+	sqTail    = (unsigned *)((char *) sqRing + params.sq_off.tail);
+	sqMask    = (unsigned *)((char *) sqRing + params.sq_off.ring_mask);
+	sqEntries = (unsigned *)((char *) sqRing + params.sq_off.ring_entries);
+	sqArray   = (unsigned *)((char *) sqRing + params.sq_off.array);
+	cqHead    = (unsigned *)((char *) cqRing + params.cq_off.head);
+	cqTail    = (unsigned *)((char *) cqRing + params.cq_off.tail);
+	cqMask    = (unsigned *)((char *) cqRing + params.cq_off.ring_mask);
+	cqes      = (struct io_uring_cqe *)((char *) cqRing + params.cq_off.cqes);
+
+	this->eventHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (this->eventHandle < 0 ||
+	    syscall(__NR_io_uring_register, this->ringHandle, IORING_REGISTER_EVENTFD,
+	            &this->eventHandle, 1) < 0)
+	{
+		printf ("error %d registering io_uring eventfd: %s\n", errno, strerror (errno));
+		if (this->eventHandle >= 0) close(this->eventHandle);
+		this->eventHandle = -1;
+	}
+}
+
+/* Define the destructor to unmap the rings and close the ring + eventfd */
+IoUring::~IoUring()
+{
+	if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+	if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+	if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+	if (this->eventHandle >= 0) close(this->eventHandle);
+	if (this->ringHandle >= 0) close(this->ringHandle);
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+bool IoUring::isValid()
+{
+	return this->ringHandle >= 0 && this->eventHandle >= 0;
+}
+
+/* Function flow:
+ * --Returns the eventfd that becomes readable when requests complete
+ */
+int IoUring::getEventHandle()
+{
+	return this->eventHandle;
+}
+
+/* Function flow:
+ * --Returns the next free SQE, cleared. If the submission queue is full,
+ *   submits what is queued first to make room
+ * --Returns 0 if there is still no room
+ *
+ */
+struct io_uring_sqe * IoUring::getSqe()
+{
+	unsigned tail = *sqTail;
+
+	if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqEntries)
+	{
+		submit();
+		if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqEntries) return 0;
+	}
+
+	unsigned index = tail & *sqMask;
+	struct io_uring_sqe * sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqArray[index] = index;
+	return sqe;
+}
+
+/* Function flow:
+ * --Queues a read of up to 'length' bytes from fd into buffer. The buffer
+ *   must stay put until the read completes
+ *
+ * Function params:
+ * userData:	Handed back with the completion, to tell requests apart
+ *
+ */
+bool IoUring::prepRead(int fd, void * buffer, unsigned length, uint64_t userData)
+{
+	struct io_uring_sqe * sqe = getSqe();
+	if (sqe == 0) return false;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t) buffer;
+	sqe->len = length;
+	sqe->off = (uint64_t) -1;	// serial ports aren't seekable: use the file position
+	sqe->user_data = userData;
+
+	__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+	pending++;
+	return true;
+}
+
+/* Function flow:
+ * --Queues a writev of numIov buffers to fd. The iovecs and what they point
+ *   to must stay put until the write completes
+ *
+ */
+bool IoUring::prepWritev(int fd, const struct iovec * iov, unsigned numIov, uint64_t userData)
+{
+	struct io_uring_sqe * sqe = getSqe();
+	if (sqe == 0) return false;
+
+	/* tty writes ignore IOCB_NOWAIT and would block io_uring_enter() until
+	   the port took everything; have a kernel worker do them instead */
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->flags = IOSQE_ASYNC;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t) iov;
+	sqe->len = numIov;
+	sqe->off = (uint64_t) -1;
+	sqe->user_data = userData;
+
+	__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+	pending++;
+	return true;
+}
+
+/* Function flow:
+ * --Queues a cancel of every request still posted on fd (before closing it)
+ */
+bool IoUring::prepCancelFd(int fd, uint64_t userData)
+{
+	struct io_uring_sqe * sqe = getSqe();
+	if (sqe == 0) return false;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = userData;
+
+	__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+	pending++;
+	return true;
+}
+
+/* Function flow:
+ * --Hands every queued request to the kernel with one io_uring_enter()
+ * --Returns the number submitted, or -1 on error
+ *
+ */
+int IoUring::submit()
+{
+	if (pending == 0) return 0;
+
+	_syscalls++;
+	int submitted = syscall(__NR_io_uring_enter, this->ringHandle, pending, 0, 0, 0, 0);
+	if (submitted < 0)
+	{
+		if (errno != EAGAIN && errno != EBUSY && errno != EINTR)
+			printf ("error %d submitting to io_uring: %s\n", errno, strerror (errno));
+		return -1;
+	}
+	pending -= submitted;
+	return submitted;
+}
+
+/* Function flow:
+ * --Calls RequestCompletedFunction for every completion waiting, in the
+ *   order the kernel finished them
+ * --The eventfd isn't read: watch it edge-triggered (EPOLLET), so each new
+ *   completion wakes the loop again without a read() per wake up
+ * --Returns the number of completions handled
+ *
+ * Function params:
+ * RequestCompletedFunction:	user-defined function location in memory
+ * context:						Handed back to the function untouched
+ *
+ */
+int IoUring::reap(CompletionHandlerFunction RequestCompletedFunction, void * context)
+{
+	int handled = 0;
+
+	unsigned head = *cqHead;
+	while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe * cqe = &cqes[head & *cqMask];
+		uint64_t userData = cqe->user_data;
+		int result = cqe->res;
+
+		/* Give the slot back before the handler queues new requests */
+		head++;
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+		RequestCompletedFunction(context, userData, result);
+		handled++;
+	}
+	return handled;
+}
+
+#endif // io_uring
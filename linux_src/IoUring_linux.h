@@ -0,0 +1,67 @@
+/*
+ * IoUring_linux.h
+ *
+ * Minimal io_uring submission/completion ring for serial I/O, talking to the
+ * kernel directly (no liburing). Reads and writes are queued as SQEs and
+ * handed to the kernel in one io_uring_enter(); completions are signalled on
+ * an eventfd so an EventLoop can wait on them next to everything else.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+class IoUring
+{
+public:
+IoUring(unsigned entries);
+~IoUring();
+
+bool isValid();
+int getEventHandle();	// Watch with EPOLLIN | EPOLLET
+
+/* Queue requests. Nothing reaches the kernel until submit() */
+bool prepRead(int fd, void * buffer, unsigned length, uint64_t userData);
+bool prepWritev(int fd, const struct iovec * iov, unsigned numIov, uint64_t userData);
+bool prepCancelFd(int fd, uint64_t userData);
+int submit();
+
+/* typedef for On-request-completed function. result is what read/write
+ * would have returned, or -errno */
+typedef void (*CompletionHandlerFunction)(void * context, uint64_t userData, int result);
+int reap(CompletionHandlerFunction RequestCompletedFunction, void * context);
+
+/* io_uring_enter() system calls made so far */
+uint64_t syscalls() const { return _syscalls; }
+
+private:
+struct io_uring_sqe * getSqe();
+
+int ringHandle;
+int eventHandle;
+unsigned pending = 0;		// SQEs queued but not yet submitted
+uint64_t _syscalls = 0;
+
+/* Shared memory with the kernel */
+void * sqRing;
+void * cqRing;
+size_t sqRingSize;
+size_t cqRingSize;
+struct io_uring_sqe * sqes;
+size_t sqesSize;
+
+unsigned * sqHead;
+unsigned * sqTail;
+unsigned * sqMask;
+unsigned * sqEntries;
+unsigned * sqArray;
+unsigned * cqHead;
+unsigned * cqTail;
+unsigned * cqMask;
+struct io_uring_cqe * cqes;
+};
@@ -24,7 +24,7 @@
 #include "/usr/include/asm-generic/ioctls.h"
 
 /* Decide if the inputted baudrate is a default */
-static int rate_to_constant(int baudrate) {
+static inline int rate_to_constant(int baudrate) {
 #define B(x) case x: return B ## x
 	switch(baudrate) {
 		B(50);     B(75);     B(110);    B(134);    B(150);
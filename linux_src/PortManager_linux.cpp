@@ -0,0 +1,787 @@
+/*
+ * PortManager_linux.cpp
+ *
+ * Defines the PortManager class: opens a set of serial ports, reads each one
+ * when the EventLoop says it is readable, and routes outgoing packets to the
+ * port their destination lives on.
+ *
+ */
+
+/*****************************************************************************
+ * Defines
+ ****************************************************************************/
+#include "PortManager_linux.h"
+
+/* io_uring user_data: port index * URING_TAGS + which request it was */
+#define URING_TAGS 16
+#define URING_READ 0
+#define URING_WRITE (URING_TAGS - 2)
+#define URING_CANCEL (URING_TAGS - 1)
+
+/*****************************************************************************
+ * Contructor/Destructor
+ ****************************************************************************/
+/* Function flow:
+ * --Starts with no ports and no known routes
+ *
+ * Function params:
+ * loop:		The event loop the ports will be watched by
+ *
+ */
+PortManager::PortManager(EventLoop * loop)
+{
+	this->loop = loop;
+	this->ioLoop = loop;
+	for (int i = 0; i < MAX_PORTS; i++)
+	{
+		ports[i].port = 0;
+		ports[i].hungUp = false;
+	}
+	for (int i = 0; i < 256; i++)
+	{
+		route[i] = -1;
+	}
+}
+
+/* Define the destructor to stop the reader thread and close every port */
+PortManager::~PortManager()
+{
+	stopReaderThread();
+	for (int i = 0; i < numAdded; i++)
+	{
+		closePort(&ports[i]);
+	}
+#ifdef HSK_HAVE_IO_URING
+	if (uring)
+	{
+		loop->removeFd(uring->getEventHandle());
+		delete uring;
+	}
+#endif
+	if (ringHandle >= 0)
+	{
+		loop->removeFd(ringHandle);
+		close(ringHandle);
+	}
+	delete rxLoop;
+}
+
+/*****************************************************************************
+ * Functions
+ ****************************************************************************/
+
+/* Function flow:
+ * --Opens a serial port without waiting for the board (see waitForBoards)
+ * --Watches it on the event loop with its own incomplete-packet timer
+ * --Returns the port's index, or -1 if it couldn't be opened
+ *
+ * Function params:
+ * portName:		Name of the serial port, e.g. /dev/ttyACM0
+ * SerialBaud:		Baudrate of the port
+ *
+ */
+int PortManager::addPort(const char *portName, int SerialBaud)
+{
+	if (numAdded >= MAX_PORTS) return -1;
+
+	PortState * state = &ports[numAdded];
+	state->port = new SerialPort(portName, SerialBaud, 0);
+	state->manager = this;
+	state->packetTimer = -1;
+	state->timerArmed = false;
+	state->rxBatch = false;
+	state->packetTimeout = packetTimeout;
+	state->txWatched = false;
+	state->txInFlight = false;
+
+	if (!state->port->isConnected())
+	{
+		delete state->port;
+		state->port = 0;
+		return -1;
+	}
+
+	/* The port's timerfd discards incomplete packets, not the port's clock */
+	state->port->setPacketTimeout(0);
+	state->port->setContext(state);
+	state->port->setPacketHandler(&PortManager::packetReceived);
+	state->packetTimer = ioLoop->addTimer(&PortManager::packetTimedOut, state);
+
+	if (state->packetTimer < 0 ||
+	    (!usingIoUring() &&
+	     !ioLoop->addFd(state->port->getHandle(), EPOLLIN, &PortManager::portReadable, state)))
+	{
+		ioLoop->removeTimer(state->packetTimer);
+		delete state->port;
+		state->port = 0;
+		return -1;
+	}
+
+#ifdef HSK_HAVE_IO_URING
+	if (uring)
+	{
+		/* io_uring hands -EAGAIN straight back on O_NONBLOCK files instead
+		   of waiting for data, so the ring gets a blocking fd */
+		int fd = state->port->getHandle();
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		postRead(state);
+		uring->submit();
+	}
+#endif
+
+	numOpen++;
+	return numAdded++;
+}
+
+/* Function flow:
+ * --Waits once for every board to wake up, then throws away whatever they
+ *   sent while booting
+ *
+ */
+void PortManager::waitForBoards(int waitTime)
+{
+	usleep(waitTime*1000);
+	for (int i = 0; i < numAdded; i++)
+	{
+		if (ports[i].port) ports[i].port->flushInput();
+	}
+}
+
+int PortManager::numPorts()
+{
+	return numOpen;
+}
+
+SerialPort * PortManager::getPort(int index)
+{
+	if (index < 0 || index >= numAdded) return 0;
+	return ports[index].port;
+}
+
+/* Function flow:
+ * --Returns the index of the port a packet handler's 'sender' is, or -1
+ */
+int PortManager::findPort(const void * sender)
+{
+	for (int i = 0; i < numAdded; i++)
+	{
+		if (ports[i].port && ports[i].port == sender) return i;
+	}
+	return -1;
+}
+
+void PortManager::setPacketHandler(SerialPort::PacketHandlerFunctionWithSender PacketReceivedFunctionWithSender)
+{
+	_PacketReceivedFunctionWithSender = PacketReceivedFunctionWithSender;
+	_PacketCheckedFunction = 0;
+}
+void PortManager::setPacketHandler(PacketCheckedFunction PacketCheckedFunction)
+{
+	_PacketReceivedFunctionWithSender = 0;
+	_PacketCheckedFunction = PacketCheckedFunction;
+}
+
+void PortManager::setAddress(uint8_t address)
+{
+	this->address = address;
+}
+
+/* Function flow:
+ * --Sets the incomplete-packet timeout of every port, and of ports added
+ *   later. A timer already running keeps its old deadline
+ *
+ */
+void PortManager::setPacketTimeout(double seconds)
+{
+	packetTimeout = seconds;
+	for (int i = 0; i < numAdded; i++)
+	{
+		ports[i].packetTimeout = seconds;
+	}
+}
+
+void PortManager::setPacketTimeout(int index, double seconds)
+{
+	if (index < 0 || index >= numAdded) return;
+	ports[index].packetTimeout = seconds;
+}
+
+/* Function flow:
+ * --Switches the manager to threaded mode: ports added from now on are
+ *   watched by a loop of their own, run by startReaderThread()
+ * --Decoded packets are queued on 'ring', and the main loop is poked through
+ *   an eventfd to run the packet handler on them
+ * --Returns FALSE if ports were already added or the eventfd failed
+ *
+ * Function params:
+ * ring:		Queue between the reader thread and the main loop
+ *
+ */
+bool PortManager::useReaderThread(FrameRing * ring)
+{
+	if (numAdded > 0 || rxLoop) return false;
+
+	ringHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ringHandle < 0 || !loop->addFd(ringHandle, EPOLLIN, &PortManager::ringReady, this))
+	{
+		if (ringHandle >= 0) close(ringHandle);
+		ringHandle = -1;
+		return false;
+	}
+
+	this->ring = ring;
+	rxLoop = new EventLoop();
+	ioLoop = rxLoop;
+	return true;
+}
+
+/* Function flow:
+ * --Starts reading the ports on their own thread (threaded mode only)
+ */
+bool PortManager::startReaderThread()
+{
+	if (rxLoop == 0 || reader.joinable()) return false;
+
+	reader = std::thread(&EventLoop::run, rxLoop);
+	return true;
+}
+
+void PortManager::stopReaderThread()
+{
+	if (!reader.joinable()) return;
+
+	rxLoop->stop();
+	reader.join();
+}
+
+FrameRing * PortManager::getRing()
+{
+	return ring;
+}
+
+/* Function flow:
+ * --Switches the manager to io_uring mode: ports added from now on are read
+ *   and written through one ring, whose completions wake the main loop
+ * --Returns FALSE if ports were already added, a reader thread is in use,
+ *   io_uring wasn't built in, or the kernel refused to set up the ring. The
+ *   manager then stays on epoll + read()/writev()
+ *
+ */
+bool PortManager::useIoUring()
+{
+#ifdef HSK_HAVE_IO_URING
+	if (numAdded > 0 || rxLoop || uring) return false;
+
+	uring = new IoUring(URING_ENTRIES);
+	if (!uring->isValid() ||
+	    !loop->addFd(uring->getEventHandle(), EPOLLIN | EPOLLET, &PortManager::uringReady, this))
+	{
+		std::cout << "io_uring unavailable, reading ports with epoll" << std::endl;
+		delete uring;
+		uring = 0;
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PortManager::usingIoUring()
+{
+#ifdef HSK_HAVE_IO_URING
+	return uring != 0;
+#else
+	return false;
+#endif
+}
+
+void PortManager::setCapture(CaptureLog * capture)
+{
+	this->capture = capture;
+}
+
+/* Function flow:
+ * --Returns the read/write system calls made on every port, open or closed,
+ *   plus the io_uring_enter() calls in io_uring mode
+ *
+ */
+uint64_t PortManager::ioSyscalls()
+{
+	uint64_t calls = closedIoCalls;
+
+	for (int i = 0; i < numAdded; i++)
+	{
+		if (ports[i].port) calls += ports[i].port->ioCalls();
+	}
+#ifdef HSK_HAVE_IO_URING
+	if (uring) calls += uring->syscalls();
+#endif
+	return calls;
+}
+
+/* Function flow:
+ * --Returns the index of the port 'address' was last heard on, or -1
+ */
+int PortManager::routeTo(uint8_t address)
+{
+	return route[address];
+}
+
+/* Function flow:
+ * --Sends the packet on the port its destination was last heard on
+ * --Broadcasts, and destinations we haven't heard from yet, go out on
+ *   every port
+ * --Returns TRUE if at least one port took the packet
+ *
+ * Function params:
+ * dst:			Destination address of the packet
+ * buffer:		The message that you want to encode and send
+ * buf_size:	The size of the message in bytes
+ *
+ */
+bool PortManager::send(uint8_t dst, uint8_t *buffer, size_t buf_size)
+{
+	bool sent = queue(dst, buffer, buf_size);
+
+	flush();
+	return sent;
+}
+
+/* Function flow:
+ * --Same routing as send(), but only puts the packet on the ports' transmit
+ *   queues. flush() writes them
+ *
+ */
+bool PortManager::queue(uint8_t dst, uint8_t *buffer, size_t buf_size)
+{
+	int index = route[dst];
+	bool sent = false;
+
+	if (index >= 0 && ports[index].port)
+	{
+		sent = ports[index].port->queue(buffer, buf_size);
+		if (sent && capture) capture->record(buffer, buf_size, index, eCaptureTx);
+		return sent;
+	}
+
+	for (int i = 0; i < numAdded; i++)
+	{
+		if (ports[i].port && ports[i].port->queue(buffer, buf_size))
+		{
+			if (capture) capture->record(buffer, buf_size, i, eCaptureTx);
+			sent = true;
+		}
+	}
+	return sent;
+}
+
+/* Function flow:
+ * --Writes every port's transmit queue
+ */
+void PortManager::flush()
+{
+	for (int i = 0; i < numAdded; i++)
+	{
+		if (ports[i].port && !ports[i].hungUp) flushPort(&ports[i]);
+	}
+#ifdef HSK_HAVE_IO_URING
+	/* Every port's write goes to the kernel in one go */
+	if (uring) uring->submit();
+#endif
+}
+
+/* Function flow:
+ * --Writes what the port will take. If some is left, waits on the main loop
+ *   for the port to be writable (EPOLLOUT); once it is all written, stops
+ *   waiting
+ * --Without a reader thread the port is already watched for EPOLLIN on the
+ *   main loop, so EPOLLOUT is added to that watch. With one, the main loop
+ *   watches the same fd for EPOLLOUT only
+ *
+ */
+void PortManager::flushPort(PortState * state)
+{
+	if (usingIoUring())
+	{
+		postWrite(state);
+		return;
+	}
+
+	int fd = state->port->getHandle();
+	bool empty = state->port->flush();
+
+	if (!empty && !state->txWatched)
+	{
+		if (ioLoop == loop)
+			state->txWatched = loop->modifyFd(fd, EPOLLIN | EPOLLOUT);
+		else
+			state->txWatched = loop->addFd(fd, EPOLLOUT, &PortManager::portWritable, state);
+	}
+	else if (empty && state->txWatched)
+	{
+		if (ioLoop == loop)
+			loop->modifyFd(fd, EPOLLIN);
+		else
+			loop->removeFd(fd);
+		state->txWatched = false;
+	}
+}
+
+/* Function flow:
+ * --Called by the main loop when a port with queued packets is writable
+ * --Resumes writing where the last partial write stopped
+ * --A hang-up is left to the port's reader
+ *
+ */
+void PortManager::portWritable(void * context, int fd, uint32_t events)
+{
+	PortState * state = (PortState *) context;
+	PortManager * manager = state->manager;
+
+	if (events & (EPOLLHUP | EPOLLERR))
+	{
+		manager->loop->removeFd(fd);
+		state->txWatched = false;
+		return;
+	}
+	manager->flushPort(state);
+}
+
+/* Function flow:
+ * --Stops watching a port and closes it. The event loop stops once no
+ *   ports are left
+ * --A port the reader thread hung up on is already unwatched
+ */
+void PortManager::closePort(PortState * state)
+{
+	if (state->port == 0) return;
+
+#ifdef HSK_HAVE_IO_URING
+	/* Reads still posted on the port come back as -ECANCELED once it is
+	   gone, and are ignored */
+	if (uring)
+	{
+		uring->prepCancelFd(state->port->getHandle(), (state - ports) * URING_TAGS + URING_CANCEL);
+		uring->submit();
+		ioLoop->removeTimer(state->packetTimer);
+	}
+	else
+#endif
+	if (!state->hungUp)
+	{
+		ioLoop->removeFd(state->port->getHandle());
+		ioLoop->removeTimer(state->packetTimer);
+	}
+	if (state->txWatched && ioLoop != loop)
+	{
+		loop->removeFd(state->port->getHandle());
+	}
+	state->txWatched = false;
+	closedIoCalls += state->port->ioCalls();
+	for (int i = 0; i < 256; i++)
+	{
+		if (route[i] == state - ports) route[i] = -1;
+	}
+	delete state->port;
+	state->port = 0;
+
+	if (--numOpen == 0) loop->stop();
+}
+
+/* Function flow:
+ * --Called by the event loop when one port has bytes to read
+ * --Reads + decodes that port only, into its own buffer
+ * --Starts that port's incomplete-packet clock if a packet is left unfinished
+ *
+ * Function params:
+ * context:		The port's PortState
+ * events:		What epoll reported for the port
+ *
+ */
+void PortManager::portReadable(void * context, int fd, uint32_t events)
+{
+	PortState * state = (PortState *) context;
+	PortManager * manager = state->manager;
+
+	/* The board was unplugged. On the reader thread, only stop watching the
+	   port; the main loop closes it */
+	if (events & (EPOLLHUP | EPOLLERR))
+	{
+		std::cout << "Serial port #" << (int)(state - manager->ports) << " closed." << std::endl;
+		if (manager->rxLoop)
+		{
+			manager->ioLoop->removeFd(fd);
+			manager->ioLoop->removeTimer(state->packetTimer);
+			state->packetTimer = -1;
+			state->hungUp = true;
+			manager->queued = true;
+			manager->notifyMainLoop();
+		}
+		else
+		{
+			manager->closePort(state);
+		}
+		return;
+	}
+
+	/* Without a reader thread, this watch also waits for EPOLLOUT */
+	if (events & EPOLLOUT)
+	{
+		manager->flushPort(state);
+		if (!(events & EPOLLIN)) return;
+	}
+
+	state->port->update(state->decodeBuffer);
+	manager->notifyMainLoop();
+	manager->restartPacketTimer(state);
+}
+
+/* Function flow:
+ * --Called once per batch of bytes read from a port
+ * --If a packet is left incomplete, (re)starts the port's timer so it runs
+ *   out packetTimeout seconds after this batch. Otherwise stops it, unless it
+ *   is already stopped
+ *
+ */
+void PortManager::restartPacketTimer(PortState * state)
+{
+	if (state->port->isReceiving() && state->packetTimeout > 0)
+	{
+		ioLoop->armTimer(state->packetTimer, state->packetTimeout);
+		state->timerArmed = true;
+	}
+	else if (state->timerArmed)
+	{
+		ioLoop->disarmTimer(state->packetTimer);
+		state->timerArmed = false;
+	}
+}
+
+/* Function flow:
+ * --Called by the event loop when a port's timer runs out: nothing has
+ *   arrived for packetTimeout seconds (CLOCK_MONOTONIC) since the last batch
+ * --Discards the incomplete packet
+ *
+ */
+void PortManager::packetTimedOut(void * context, int timer)
+{
+	PortState * state = (PortState *) context;
+
+	state->timerArmed = false;
+	state->port->discardPacket();
+}
+
+/* Function flow:
+ * --Called by a port for each packet it decodes
+ * --In threaded mode, queues a copy on the ring for the main loop (the
+ *   port's decode buffer is reused by its next packet), stamped with the
+ *   time now for the capture log. Otherwise, delivers it right away
+ *
+ */
+void PortManager::packetReceived(const void * sender, const uint8_t * buffer, size_t size)
+{
+	SerialPort * port = (SerialPort *) sender;
+	PortState * state = (PortState *) port->getContext();
+	PortManager * manager = state->manager;
+
+	if (manager->ring)
+	{
+		if (manager->ring->push(buffer, size, state - manager->ports, port->packetSum(), captureTime()))
+			manager->queued = true;
+		return;
+	}
+	manager->deliver(state, buffer, size, port->packetSum());
+}
+
+/* Function flow:
+ * --Checks the packet with the sum its decoder added up (checkPacket()),
+ *   and records it in the capture log if there is one
+ * --If its header can be trusted, remembers which port its source lives on
+ * --Hands the packet to the user's handler with the port as 'sender': with
+ *   the result to a PacketCheckedFunction, or, if it passed, to a
+ *   PacketHandlerFunctionWithSender
+ *
+ * Function params:
+ * sum:			Byte sum of the packet, from the decoder
+ * decodedAt:	When the reader thread decoded it; 0 if it just was
+ *
+ */
+void PortManager::deliver(PortState * state, const uint8_t * buffer, size_t size, uint8_t sum,
+                          const capture_time_t * decodedAt)
+{
+	const housekeeping_hdr_t * hdr = (const housekeeping_hdr_t *) buffer;
+	packet_status_t status = checkPacket(buffer, size, sum, address);
+
+	if (capture && decodedAt) capture->record(buffer, size, state - ports, eCaptureRx, status, *decodedAt);
+	else if (capture) capture->record(buffer, size, state - ports, eCaptureRx, status);
+
+	if ((status == ePacketOK || status == ePacketBadDest) && hdr->src != eBroadcast)
+	{
+		route[hdr->src] = state - ports;
+	}
+
+	if (_PacketCheckedFunction)
+	{
+		_PacketCheckedFunction(state->port, buffer, size, status);
+	}
+	else if (_PacketReceivedFunctionWithSender && status == ePacketOK)
+	{
+		_PacketReceivedFunctionWithSender(state->port, buffer, size);
+	}
+}
+
+/* Function flow:
+ * --Reader thread: pokes the main loop once per read if anything was queued
+ */
+void PortManager::notifyMainLoop()
+{
+	uint64_t poke = 1;
+
+	if (!queued) return;
+	queued = false;
+	write(ringHandle, &poke, sizeof(poke));
+}
+
+/* Function flow:
+ * --Main loop: called when the reader thread has queued packets
+ * --Runs the packet handler on every queued packet, oldest first, then
+ *   closes any port the reader thread hung up on
+ *
+ * Function params:
+ * context:		The PortManager
+ *
+ */
+void PortManager::ringReady(void * context, int fd, uint32_t events)
+{
+	PortManager * manager = (PortManager *) context;
+	const frame_slot_t * slot;
+	uint64_t pokes;
+
+	read(fd, &pokes, sizeof(pokes));
+
+	while ((slot = manager->ring->front()) != 0)
+	{
+		PortState * state = &manager->ports[slot->port];
+		if (state->port) manager->deliver(state, slot->data, slot->size, slot->sum, &slot->time);
+		manager->ring->pop();
+	}
+
+	for (int i = 0; i < manager->numAdded; i++)
+	{
+		if (manager->ports[i].hungUp) manager->closePort(&manager->ports[i]);
+	}
+}
+
+/* Function flow:
+ * --io_uring mode: posts a read of up to READ_CHUNK bytes from the port into
+ *   its chunk buffer. Nothing is submitted until the caller is done posting
+ *
+ */
+void PortManager::postRead(PortState * state)
+{
+#ifdef HSK_HAVE_IO_URING
+	uring->prepRead(state->port->getHandle(), state->rxChunk, READ_CHUNK,
+	                (state - ports) * URING_TAGS + URING_READ);
+#endif
+}
+
+/* Function flow:
+ * --io_uring mode: posts one writev of everything on the port's transmit
+ *   queue, unless one is already on its way. Packets queued meanwhile go out
+ *   with the next one
+ *
+ */
+void PortManager::postWrite(PortState * state)
+{
+#ifdef HSK_HAVE_IO_URING
+	if (state->txInFlight || !state->port->txPending()) return;
+
+	int numIov = state->port->txIovecs(state->txIov);
+	state->txInFlight = uring->prepWritev(state->port->getHandle(), state->txIov, numIov,
+	                                      (state - ports) * URING_TAGS + URING_WRITE);
+#endif
+}
+
+/* Function flow:
+ * --Main loop: called when io_uring requests have completed
+ * --Handles every completion, then submits the reads + writes they posted
+ *   with one io_uring_enter()
+ * --Restarts the incomplete-packet timer of each port that got bytes
+ *
+ */
+void PortManager::uringReady(void * context, int fd, uint32_t events)
+{
+#ifdef HSK_HAVE_IO_URING
+	PortManager * manager = (PortManager *) context;
+
+	manager->uring->reap(&PortManager::requestCompleted, manager);
+	manager->uring->submit();
+
+	/* One timer update per port per batch of completions */
+	for (int i = 0; i < manager->numAdded; i++)
+	{
+		PortState * state = &manager->ports[i];
+		if (state->port && state->rxBatch)
+		{
+			state->rxBatch = false;
+			manager->restartPacketTimer(state);
+		}
+	}
+#endif
+}
+
+/* Function flow:
+ * --Called for each io_uring completion, in the order the kernel finished
+ *   them. A port has one read posted at a time, so its bytes come in order
+ * --Read: decodes the bytes like portReadable() does, then posts the read
+ *   again. 0 bytes, or an error, means the board is gone
+ * --Write: retires what the port took and posts the rest, plus anything
+ *   queued since
+ *
+ * Function params:
+ * userData:	port index * URING_TAGS + URING_READ, URING_WRITE or URING_CANCEL
+ * result:		What read()/writev() would have returned, or -errno
+ *
+ */
+void PortManager::requestCompleted(void * context, uint64_t userData, int result)
+{
+	PortManager * manager = (PortManager *) context;
+	PortState * state = &manager->ports[userData / URING_TAGS];
+	int tag = userData % URING_TAGS;
+
+	/* Leftovers of a port that has been closed */
+	if (state->port == 0 || tag == URING_CANCEL) return;
+
+	if (tag == URING_WRITE)
+	{
+		state->txInFlight = false;
+		if (result > 0)
+		{
+			state->port->txWritten(result);
+		}
+		else if (result < 0 && result != -EINTR && result != -EAGAIN)
+		{
+			printf ("error %d writing to port: %s\n", -result, strerror (-result));
+			return;
+		}
+		manager->postWrite(state);
+		return;
+	}
+
+	if (result == -EINTR || result == -EAGAIN)
+	{
+		manager->postRead(state);
+		return;
+	}
+	if (result <= 0)
+	{
+		std::cout << "Serial port #" << (int)(state - manager->ports) << " closed." << std::endl;
+		manager->closePort(state);
+		return;
+	}
+
+	state->port->receive(state->rxChunk, result, state->decodeBuffer);
+	state->rxBatch = true;
+	manager->postRead(state);
+}
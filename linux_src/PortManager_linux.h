@@ -0,0 +1,174 @@
+/*
+ * PortManager_linux.h
+ *
+ * Drives several SerialPort instances (one per housekeeping board) from one
+ * EventLoop. Each port keeps its own decode buffer and incomplete-packet
+ * timer, so a slow or noisy board can't stall the others.
+ *
+ * In threaded mode the ports are read + decoded on a dedicated reader thread
+ * with its own EventLoop. Decoded packets are queued on a FrameRing and the
+ * packet handler runs on the main loop, so slow handlers (printing to a
+ * terminal, ...) never hold up reading the ports.
+ *
+ * In io_uring mode the ports are read and written through one io_uring
+ * instead: one read stays posted on every port, and the queued writes of
+ * every port go to the kernel with a single io_uring_enter(). One read, not
+ * several: tty reads run on concurrent kernel workers, so several posted
+ * reads of a port could complete, and be decoded, out of order. The
+ * main loop only waits on the ring's completion eventfd.
+ *
+ */
+#pragma once
+
+#include "SerialPort_linux.h"
+#include "EventLoop_linux.h"
+#include "FrameRing.h"
+#include "CaptureLog.h"
+#include "../iProtocol.h"
+
+#include <atomic>
+#include <thread>
+
+/* io_uring needs the kernel's uapi header; build with -DHSK_NO_IO_URING to
+ * leave it out altogether */
+#if !defined(HSK_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HSK_HAVE_IO_URING 1
+#include "IoUring_linux.h"
+#endif
+#endif
+
+/* define MAX_PORTS for the most serial ports one manager can drive */
+#define MAX_PORTS 8
+/* define URING_ENTRIES for the io_uring submission queue size */
+#define URING_ENTRIES 64
+
+class PortManager
+{
+public:
+PortManager(EventLoop * loop);
+~PortManager();
+
+/* Opening ports. addPort returns the port's index, or -1 */
+int addPort(const char *portName, int SerialBaud);
+void waitForBoards(int waitTime = WAIT_TIME);
+int numPorts();
+SerialPort * getPort(int index);
+int findPort(const void * sender);
+
+/* typedef for On-packet-checked function: every decoded packet, with what
+ * checkPacket() found. The packet isn't read again to check it */
+typedef void (*PacketCheckedFunction)(const void * sender,
+                                      const uint8_t * buffer,
+                                      size_t size,
+                                      packet_status_t status);
+
+/* Handler for packets from every port. 'sender' is the SerialPort. The
+ * first one only gets packets that passed checkPacket() */
+void setPacketHandler(SerialPort::PacketHandlerFunctionWithSender PacketReceivedFunctionWithSender);
+void setPacketHandler(PacketCheckedFunction PacketCheckedFunction);
+
+/* Our address, for the destination check. eBroadcast (the default) takes
+ * packets for anyone */
+void setAddress(uint8_t address);
+
+/* Sending, to the port the destination was last heard on. queue() + flush()
+ * writes a batch of packets with one writev() per port */
+bool send(uint8_t dst, uint8_t *buffer, size_t buf_size);
+bool queue(uint8_t dst, uint8_t *buffer, size_t buf_size);
+void flush();
+int routeTo(uint8_t address);
+
+/* Discard an incomplete packet this many seconds after its last byte, on
+ * every port or on one. 0 never discards */
+void setPacketTimeout(double seconds);
+void setPacketTimeout(int index, double seconds);
+
+/* Threaded mode. useReaderThread must come before the first addPort */
+bool useReaderThread(FrameRing * ring);
+bool startReaderThread();
+void stopReaderThread();
+FrameRing * getRing();
+
+/* io_uring mode. useIoUring must come before the first addPort, and can't be
+ * combined with a reader thread. Returns FALSE if the kernel won't set up a
+ * ring, in which case the ports are read with epoll + read() as usual */
+bool useIoUring();
+bool usingIoUring();
+
+/* Records every packet queued on a port and every packet decoded, whether
+ * or not it passed checkPacket(). 0 stops recording */
+void setCapture(CaptureLog * capture);
+
+/* System calls made to read + write the ports so far (read, writev,
+ * io_uring_enter, ...), for comparing the backends */
+uint64_t ioSyscalls();
+
+private:
+/* Everything one port needs to receive on its own */
+struct PortState
+{
+	SerialPort * port;
+	PortManager * manager;
+	int packetTimer;			// timerfd, armed while a packet is incomplete
+	bool timerArmed;
+	bool rxBatch;				// io_uring mode: bytes arrived in this batch
+	double packetTimeout;
+	bool txWatched;				// Waiting for the port to be writable
+	std::atomic<bool> hungUp;	// Set by the reader thread, closed by the main one
+	uint8_t decodeBuffer[MAX_PACKET_LENGTH];
+
+	/* io_uring mode: buffer of the posted read, and the posted write */
+	uint8_t rxChunk[READ_CHUNK];
+	struct iovec txIov[TX_QUEUE_DEPTH];
+	bool txInFlight;
+};
+
+static void portReadable(void * context, int fd, uint32_t events);
+static void portWritable(void * context, int fd, uint32_t events);
+void flushPort(PortState * state);
+static void packetTimedOut(void * context, int timer);
+void restartPacketTimer(PortState * state);
+static void packetReceived(const void * sender, const uint8_t * buffer, size_t size);
+static void ringReady(void * context, int fd, uint32_t events);
+void deliver(PortState * state, const uint8_t * buffer, size_t size, uint8_t sum,
+             const capture_time_t * decodedAt = 0);
+void notifyMainLoop();
+void closePort(PortState * state);
+
+/* io_uring mode */
+void postRead(PortState * state);
+void postWrite(PortState * state);
+static void uringReady(void * context, int fd, uint32_t events);
+static void requestCompleted(void * context, uint64_t userData, int result);
+
+EventLoop * loop;		// Handlers run on this loop
+EventLoop * ioLoop;		// Ports are read on this loop: loop, or rxLoop in threaded mode
+
+/* Threaded mode */
+EventLoop * rxLoop = 0;
+FrameRing * ring = 0;
+int ringHandle = -1;	// eventfd the reader thread pokes after queuing packets
+bool queued = false;	// Reader thread only: packets queued since the last poke
+std::thread reader;
+PortState ports[MAX_PORTS];
+int numOpen = 0;
+int numAdded = 0;
+double packetTimeout = 0.25;	// For ports added from now on
+
+/* io_uring mode */
+#ifdef HSK_HAVE_IO_URING
+IoUring * uring = 0;
+#endif
+uint64_t closedIoCalls = 0;	// ioCalls() of ports already closed
+
+/* Port index each address was last heard on, -1 if never */
+int route[256];
+
+uint8_t address = eBroadcast;
+
+CaptureLog * capture = 0;
+
+SerialPort::PacketHandlerFunctionWithSender _PacketReceivedFunctionWithSender = 0;
+PacketCheckedFunction _PacketCheckedFunction = 0;
+};
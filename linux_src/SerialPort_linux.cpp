@@ -10,7 +10,6 @@
  * Defines
  ****************************************************************************/
 #include "SerialPort_linux.h"
-#include "../COBS.h"
 
 /*****************************************************************************
  * Contructor/Destructor
@@ -21,11 +20,14 @@
  *
  * Function params:
  * portName:		Name of our opened serial port in SerialPort_linux
+ * waitTime:		Milliseconds to wait for the board to wake up. Pass 0 when
+ *					opening several ports, wait once, then flushInput() each
  *
  */
-SerialPort::SerialPort(const char *portName, int SerialBaud)
+SerialPort::SerialPort(const char *portName, int SerialBaud, int waitTime)
 {
 	this->connected = false;
+	_decoder.setFrameHandler(&SerialPort::frameDecoded, this);
 
 	this->handler = open (portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
@@ -40,9 +42,11 @@ SerialPort::SerialPort(const char *portName, int SerialBaud)
 		set_interface_attribs (this->handler, SerialBaud, 0); // set baudrate, 8n1 (no parity)
 		// set_mincount (this->handler, 0);     // set  blocking IF O_NONBLOCK not set
 		this->connected = true; // set status to 'connected'
-		usleep(WAIT_TIME*1000); // sleep until the board wakes up
-		/* flush the input buffer, prep for new communication. I don't think this works */
-		tcflush(this->handler, TCIFLUSH);
+		if (waitTime > 0)
+		{
+			usleep(waitTime*1000); // sleep until the board wakes up
+			flushInput();
+		}
 
 	}
 }
@@ -81,113 +85,293 @@ void SerialPort::setPacketHandler(PacketHandlerFunctionWithSender PacketReceived
 }
 
 /* Function flow:
- * --Reads in one byte at a time
- * --If the packetMarker is received, the function decodes the COBS encoded
- *   packet and executes the PacketReceivedFunction.
- * --Returns the number of bytes decoded.
+ * --Called by the COBS decoder each time a full packet has been decoded
+ * --Executes whichever PacketReceivedFunction was defined (with or w/o sender)
  *
  * Function Params:
- * decodeBuffer:	The buffer into which the result will be written
+ * context:		The SerialPort instance that read the packet
+ * buffer:		The decoded packet (update()'s decodeBuffer)
+ * size:		Size of the decoded packet
+ *
+ */
+void SerialPort::frameDecoded(void * context, const uint8_t * buffer, size_t size)
+{
+	SerialPort * port = (SerialPort *) context;
+
+	port->_numDecoded += size;
+	if (port->_PacketReceivedFunction)
+	{
+		port->_PacketReceivedFunction(buffer, size);
+	}
+
+	else if (port->_PacketReceivedFunctionWithSender)
+	{
+		port->_PacketReceivedFunctionWithSender(port, buffer, size);
+	}
+}
+
+/* Function flow:
+ * --Drains everything the port has buffered, READ_CHUNK bytes per read() and
+ *   at most MAX_READS reads, and hands each chunk to the COBS decoder, which
+ *   decodes it in place into decodeBuffer
+ * --Every packet completed by those bytes is passed to the
+ *   PacketReceivedFunction as soon as it is decoded (see frameDecoded()), so
+ *   one update() can handle several packets
+ * --Returns the number of bytes decoded, summed over those packets.
+ *
+ * Function Params:
+ * decodeBuffer:	The buffer into which the result will be written. Must hold
+ *				MAX_PACKET_LENGTH bytes and should be the same on every call,
+ *				since a packet may be split across calls.
  *
  * Function variables:
- * bytesRead:	total number of bytes read by ReadFile function in that read
- * data:		location where the read byte gets put by ReadFile
- * data_ptr:	pointer to data's location. Used to put byte into receiving buffer
+ * bytesRead:	number of bytes returned by the last read()
  * time_LastByteReceived:   Time stamp for when the last byte without a complete packet
- * time_Current:            Time stamp for the current time
- * clockNeedsReset:         Bool for when the time stamp should reset
  *
  */
 int SerialPort::update(uint8_t *decodeBuffer)
 {
-	int bytesAvailable;
-	uint8_t data;
-	uint8_t*    data_ptr;
-	data_ptr =  &data;
+	ssize_t bytesRead;
+	bool gotBytes = false;
+
+	_decoder.setOutput(decodeBuffer, MAX_PACKET_LENGTH);
+	_numDecoded = 0;
 
 	/* Evaluate time stamps */
 	if (checkForBadPacket()) return 0;
-	bytesAvailable = read(this->handler, data_ptr, 1);
 
-	while (bytesAvailable > 0)
+	/* A short read means the kernel buffer is empty. Anything past MAX_READS
+	   is left for the next update */
+	for (int reads = 0; reads < MAX_READS; reads++)
 	{
-		if (checkForBadPacket()) return 0;
+		bytesRead = read(this->handler, _readBuffer, READ_CHUNK);
+		_ioCalls.fetch_add(1, std::memory_order_relaxed);
+		if (bytesRead <= 0) break;
 
-		if (*data_ptr == PACKETMARKER)
-		{
-			/* Stop the clock */
-			this->OK_toGetCurrTime = false;
-
-			size_t numDecoded = COBS::decode(_receiveBuffer,
-			                                 _receiveBufferIndex,
-			                                 decodeBuffer);
-			// Execute whichever function was defined (with or w/o sender)
-			if (_PacketReceivedFunction)
-			{
-				_PacketReceivedFunction(decodeBuffer, numDecoded);
-			}
+		gotBytes = true;
+		_decoder.feed(_readBuffer, bytesRead);
+		if (bytesRead < READ_CHUNK) break;
+	}
 
-			else if (_PacketReceivedFunctionWithSender)
-			{
-				_PacketReceivedFunctionWithSender(this, _receiveBuffer, numDecoded);
-			}
+	stampClock(gotBytes);
+	return _numDecoded;
+}
 
-			// Clear the buffer
-			memset(_receiveBuffer, 0, _receiveBufferIndex);
-			_receiveBufferIndex = 0;
-			return(numDecoded);
-		}
-		else
+/* Function flow:
+ * --Same as update(), for bytes that were already read some other way (an
+ *   io_uring read completion, ...): decodes them into decodeBuffer and
+ *   passes every completed packet to the PacketReceivedFunction
+ * --Returns the number of bytes decoded
+ *
+ * Function Params:
+ * bytes:			Raw bytes from the port, in the order they arrived
+ * size:			Number of raw bytes
+ * decodeBuffer:	As for update()
+ *
+ */
+int SerialPort::receive(const uint8_t *bytes, size_t size, uint8_t *decodeBuffer)
+{
+	_decoder.setOutput(decodeBuffer, MAX_PACKET_LENGTH);
+	_numDecoded = 0;
+
+	if (checkForBadPacket()) return 0;
+
+	_decoder.feed(bytes, size);
+	stampClock(size > 0);
+	return _numDecoded;
+}
+
+/* Function flow:
+ * --Starts the incomplete-packet clock if a packet is left unfinished, once
+ *   per batch of bytes; stops it once the packet is done
+ * --Does nothing with the clock off (setPacketTimeout(0))
+ *
+ */
+void SerialPort::stampClock(bool gotBytes)
+{
+	if (_decoder.inFrame() && _packetTimeout > 0)
+	{
+		if (gotBytes)
 		{
-			this->time_LastByteReceived = std::chrono::system_clock::now();
+			this->time_LastByteReceived = std::chrono::steady_clock::now();
 			this->OK_toGetCurrTime = true;
-
-			if ((_receiveBufferIndex + 1) < MAX_PACKET_LENGTH)
-			{
-				_receiveBuffer[_receiveBufferIndex++] = *data_ptr;
-			}
-			else
-			{
-				_receiveBufferIndex = 0;
-				return 0;
-			}
 		}
-		bytesAvailable = read(this->handler, data_ptr, 1);
 	}
-
-	return 0;
+	else
+	{
+		/* Stop the clock */
+		this->OK_toGetCurrTime = false;
+	}
 }
 
 /* Function flow:
- * --Send function takes a non-COBS encoded input, encodes it, and writes it
- *   to the serial line.
- * --Returns TRUE if the write was successful, FALSE if not.
+ * --Send function takes a non-COBS encoded input, encodes it onto the
+ *   transmit queue, and writes as much of the queue as the port will take.
+ * --Returns TRUE if the packet was queued, FALSE if not (empty message, or
+ *   the queue is full). Whatever the port didn't take yet is written by
+ *   flush() when the port is writable again.
  *
  * Function Params:
  * buffer:		The message that you want to encode and send
  * buf_size:	The size of the message in bytes
  *
+ */
+bool SerialPort::send(uint8_t *buffer, size_t buf_size)
+{
+	if (!queue(buffer, buf_size)) return false;
+
+	flush();
+	return true;
+}
+
+/* Function flow:
+ * --Encodes a message straight into the next free transmit queue slot
+ *   without writing it. Queue several, then flush() once to write them all
+ *   with a single writev().
+ * --Returns TRUE if the message was queued
+ *
+ * Function Params:
+ * buffer:		The message that you want to encode and send
+ * buf_size:	The size of the message in bytes, at most 4 + 255 + 4
+ *
  * Function variables:
- * bytesSend:	total number of bytes sent by WriteFile function in that write
- * encodedBuffer:	buffer to put the encoded message into
- * numEncoded:	number of bytes that were encoded. Does not include packet delimiter
+ * slot:		Index of the queue slot the message is encoded into
  *
  */
-bool SerialPort::send(uint8_t *buffer, size_t buf_size)
+bool SerialPort::queue(uint8_t *buffer, size_t buf_size)
 {
-	uint8_t bytesSend;
 	/* if the message is not empty & the size of the message wasn't 0 by accident */
-	if (buffer != 0 && buf_size != 0)
+	if (buffer == 0 || buf_size == 0 || !this->connected ||
+	    COBS::getEncodedBufferSize(buf_size) > MAX_ENCODED_LENGTH)
 	{
-		uint8_t encodedBuffer[COBS::getEncodedBufferSize(buf_size)];
+		return false;
+	}
+
+	if (_txCount == TX_QUEUE_DEPTH)
+	{
+		_txDropped++;
+		return false;
+	}
 
-		size_t numEncoded = COBS::encode(buffer, buf_size, encodedBuffer);
+	size_t slot = (_txHead + _txCount) % TX_QUEUE_DEPTH;
+	_txSizes[slot] = COBS::encode(buffer, buf_size, _txFrames[slot]);
+	_txBytes += _txSizes[slot];
+	_txCount++;
+	return true;
+}
+
+/* Function flow:
+ * --Writes the whole transmit queue with one writev(), picking up the oldest
+ *   packet where the last partial write left off
+ * --Drops every packet the port fully took from the queue
+ * --Returns TRUE if the queue is now empty. FALSE means the port is full
+ *   (wait for it to be writable, e.g. EPOLLOUT) or the write failed
+ *
+ * Function variables:
+ * iov:			One entry per queued packet
+ * written:		Bytes the port took in this writev()
+ *
+ */
+bool SerialPort::flush()
+{
+	struct iovec iov[TX_QUEUE_DEPTH];
+	ssize_t written;
 
-		bytesSend = write(this->handler, (void*) encodedBuffer, numEncoded);
+	while (_txCount > 0)
+	{
+		written = writev(this->handler, iov, txIovecs(iov));
+		_ioCalls.fetch_add(1, std::memory_order_relaxed);
+		if (written < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				printf ("error %d writing to port: %s\n", errno, strerror (errno));
+			}
+			return false;
+		}
+		txWritten(written);
 
-		return true;
+		/* Partial write: the port is full for now */
+		if (_txCount > 0) return false;
 	}
-	else return false;
+	return true;
+}
+
+/* Function flow:
+ * --Points one iovec at each queued packet, the oldest one starting where
+ *   the last partial write left off
+ * --Returns the number of iovecs filled (txQueueDepth())
+ *
+ * Function Params:
+ * iov:			Room for TX_QUEUE_DEPTH entries
+ *
+ */
+int SerialPort::txIovecs(struct iovec *iov)
+{
+	for (size_t i = 0; i < _txCount; i++)
+	{
+		size_t slot = (_txHead + i) % TX_QUEUE_DEPTH;
+		iov[i].iov_base = _txFrames[slot];
+		iov[i].iov_len = _txSizes[slot];
+	}
+	if (_txCount > 0)
+	{
+		iov[0].iov_base = _txFrames[_txHead] + _txOffset;
+		iov[0].iov_len -= _txOffset;
+	}
+	return _txCount;
+}
+
+/* Function flow:
+ * --Drops every packet the port fully took from the queue, and remembers how
+ *   much of the next one it took
+ *
+ * Function Params:
+ * written:		Bytes the port took, counted from the start of txIovecs()
+ *
+ */
+void SerialPort::txWritten(size_t written)
+{
+	_txBytes -= written;
+
+	/* Retire every packet that went out whole */
+	written += _txOffset;
+	while (_txCount > 0 && written >= _txSizes[_txHead])
+	{
+		written -= _txSizes[_txHead];
+		_txHead = (_txHead + 1) % TX_QUEUE_DEPTH;
+		_txCount--;
+	}
+	_txOffset = written;
+}
+
+/* Function flow:
+ * --Transmit queue statistics
+ * --txPending: packets (or part of one) are still waiting to be written
+ * --txQueueDepth: packets waiting, including a partly written one
+ * --txBytesInFlight: encoded bytes the port hasn't taken yet
+ * --txDropped: packets refused because the queue was full
+ *
+ */
+bool SerialPort::txPending()
+{
+	return _txCount > 0;
+}
+
+size_t SerialPort::txQueueDepth()
+{
+	return _txCount;
+}
+
+size_t SerialPort::txBytesInFlight()
+{
+	return _txBytes;
+}
+
+size_t SerialPort::txDropped()
+{
+	return _txDropped;
 }
 
 /* Function flow:
@@ -200,27 +384,96 @@ bool SerialPort::isConnected()
 	return this->connected;
 }
 
+/* Function flow:
+ * --Returns TRUE if part of a packet has been read and its packetMarker
+ *   hasn't arrived yet
+ *
+ */
+bool SerialPort::isReceiving()
+{
+	return _decoder.inFrame();
+}
+
+/* Function flow:
+ * --Returns the file descriptor of the open port, so it can be waited on
+ *   (see EventLoop_linux.h). -1 if the port didn't open
+ *
+ */
+int SerialPort::getHandle()
+{
+	return this->connected ? this->handler : -1;
+}
+
+/* Function flow:
+ * --Throws away whatever the board sent before we were ready for it
+ *
+ */
+void SerialPort::flushInput()
+{
+	/* flush the input buffer, prep for new communication. I don't think this works */
+	if (this->connected) tcflush(this->handler, TCIFLUSH);
+}
+
+void SerialPort::setContext(void * context)
+{
+	_context = context;
+}
+
+void * SerialPort::getContext() const
+{
+	return _context;
+}
+
+/* Function flow:
+ * --If the port's clock is running and nothing has arrived for the packet
+ *   timeout, throws the incomplete packet away (see discardPacket())
+ * --Returns TRUE if a packet was thrown away
+ *
+ */
 bool SerialPort::checkForBadPacket()
 {
 	if (this->OK_toGetCurrTime)
 	{
-		this->time_Current = std::chrono::system_clock::now();
+		this->time_Current = std::chrono::steady_clock::now();
 		this->byteless_interval = this->time_Current - this->time_LastByteReceived;
 
-		/* If an incomplete packet was received, print an error and show the buffer data */
-		if (this->byteless_interval.count() > .25)
+		if (this->byteless_interval.count() > _packetTimeout)
 		{
-			this->OK_toGetCurrTime = false;
-			std::cout << "Error: Incomplete packet received. Bytes received:";
-			for (int i=0; i < this->_receiveBufferIndex; i++)
-			{
-				std::cout << (int) this->_receiveBuffer[this->_receiveBufferIndex];
-				std::cout << " ";
-			}
-			this->_receiveBufferIndex = 0;
-			std::cout << std::endl << std::endl;
+			discardPacket();
 			return true;
 		}
 	}
 	return false;
 }
+
+/* Function flow:
+ * --Throws away the packet being decoded, printing an error with the bytes
+ *   decoded so far, and stops the clock
+ *
+ */
+void SerialPort::discardPacket()
+{
+	this->OK_toGetCurrTime = false;
+	if (!_decoder.inFrame()) return;
+
+	/* If an incomplete packet was received, print an error and show the buffer data */
+	std::cout << "Error: Incomplete packet received. Bytes decoded:";
+	for (size_t i=0; i < _decoder.decodedSize(); i++)
+	{
+		std::cout << (int) _decoder.output()[i];
+		std::cout << " ";
+	}
+	_decoder.reset();
+	std::cout << std::endl << std::endl;
+}
+
+/* Function flow:
+ * --Sets how long an incomplete packet may go without a byte. 0 stops the
+ *   port's own clock for good
+ *
+ */
+void SerialPort::setPacketTimeout(double seconds)
+{
+	_packetTimeout = seconds;
+	if (seconds <= 0) this->OK_toGetCurrTime = false;
+}
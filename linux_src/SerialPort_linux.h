@@ -8,37 +8,83 @@
 #pragma once
 
 #include "LinuxLib.h"
+#include "../COBS.h"
 
+#include <atomic>
 #include <cstdint>
 #include <errno.h>
 #include <fcntl.h>
 // #include <termios.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <chrono>
 
 /* Max data length is:
  *	--4 header bytes
  *	-- + 255 data bytes
- *  -- + 1 CRC (checksum) byte
+ *  -- + 1 checksum byte, or up to 4 CRC bytes (see integrity_mode_t)
  * For max packet size,
  *	-- +1 COBS overhead
  *	-- +1 COBS packet marker
  */
-#define MAX_PACKET_LENGTH (4 + 255 + 1) + 2
+#define MAX_PACKET_LENGTH (4 + 255 + 4) + 2
 /* define WAIT_TIME for time to wait after connecting to board */
 #define WAIT_TIME 2500
+/* define READ_CHUNK for the most bytes update() asks read() for at once */
+#define READ_CHUNK 4096
+/* define MAX_READS for the most reads one update() makes, so one noisy
+ * port can't keep the others waiting */
+#define MAX_READS 16
+
+/* Largest encoded packet: 263 bytes, +1 COBS code byte per 254, +2 for the
+ * first code byte and the packet marker */
+#define MAX_ENCODED_LENGTH ((4 + 255 + 4) + (4 + 255 + 4) / 254 + 2)
+/* define TX_QUEUE_DEPTH for the most encoded packets waiting to be written */
+#define TX_QUEUE_DEPTH 64
 
 class SerialPort
 {
 public:
-SerialPort(const char *portName, int SerialBaud);
+SerialPort(const char *portName, int SerialBaud, int waitTime = WAIT_TIME);
 ~SerialPort();
 
 /* Define functions that SerialPort will use */
 int update(uint8_t *buffer);
+int receive(const uint8_t *bytes, size_t size, uint8_t *buffer);
 bool send(uint8_t *buffer, size_t buf_size);
+bool queue(uint8_t *buffer, size_t buf_size);
+bool flush();
 bool isConnected();
 bool checkForBadPacket();
+void discardPacket();
+bool isReceiving();
+uint8_t packetSum() const { return _decoder.frameSum(); }	// Inside the packet handler: byte sum of the packet
+int getHandle();
+void flushInput();
+
+/* Transmit queue statistics */
+bool txPending();
+size_t txQueueDepth();
+size_t txBytesInFlight();
+size_t txDropped();
+
+/* Transmit queue, for writing it some other way than flush() (io_uring).
+ * txIovecs describes what is left to write; txWritten retires what went out */
+int txIovecs(struct iovec *iov);
+void txWritten(size_t written);
+
+/* Seconds without a byte before an incomplete packet is thrown away. 0 turns
+ * the port's own clock off, for an owner that times packets out itself
+ * (e.g. with a timerfd, see PortManager_linux.h) and calls discardPacket() */
+void setPacketTimeout(double seconds);
+double getPacketTimeout() const { return _packetTimeout; }
+
+/* read()/writev() system calls made so far */
+uint64_t ioCalls() const { return _ioCalls.load(std::memory_order_relaxed); }
+
+/* Opaque pointer for whoever owns this port (see PortManager_linux.h) */
+void setContext(void * context);
+void * getContext() const;
 
 /* typdefs for On-package-received function */
 typedef void (*PacketHandlerFunction)(const uint8_t * buffer,
@@ -55,16 +101,37 @@ private:
 int handler;
 bool connected;
 
-/* COBS helpers for receiving an unknown packet */
-uint8_t _receiveBuffer[MAX_PACKET_LENGTH] = {0};
-size_t _receiveBufferIndex = 0;
+/* Raw bytes from the last read(), before decoding */
+uint8_t _readBuffer[READ_CHUNK];
+
+/* Decodes bytes as they are read, straight into update()'s buffer */
+COBSDecoder _decoder;
+int _numDecoded = 0;
+static void frameDecoded(void * context, const uint8_t * buffer, size_t size);
+void stampClock(bool gotBytes);
+/* Counted by update() on the reader thread and flush() on the main one */
+std::atomic<uint64_t> _ioCalls{0};
+
+void * _context = 0;
 
 /* On-packet-received function initialization */
 PacketHandlerFunction _PacketReceivedFunction = 0;
 PacketHandlerFunctionWithSender _PacketReceivedFunctionWithSender = 0;
 
-/* Timing variables for discarding incomplete packets */
-std::chrono::time_point<std::chrono::system_clock> time_LastByteReceived, time_Current;
+/* Transmit queue: encoded packets waiting to be written, oldest at _txHead.
+ * _txOffset bytes of the oldest one have already been written */
+uint8_t _txFrames[TX_QUEUE_DEPTH][MAX_ENCODED_LENGTH];
+size_t _txSizes[TX_QUEUE_DEPTH];
+size_t _txHead = 0;
+size_t _txCount = 0;
+size_t _txOffset = 0;
+size_t _txBytes = 0;
+size_t _txDropped = 0;
+
+/* Timing variables for discarding incomplete packets. steady_clock, so a
+ * wall clock step (NTP, ...) can't throw a packet away */
+std::chrono::time_point<std::chrono::steady_clock> time_LastByteReceived, time_Current;
 std::chrono::duration<double> byteless_interval;
 bool OK_toGetCurrTime = false;
+double _packetTimeout = 0.25;
 };
@@ -13,17 +13,21 @@
  * Defines
  *******************************************************************************/
 #ifdef _WIN32
-#include "win_src/SerialPort.cpp"
 #include "win_src/SerialPort.h"
 #endif
 
 #ifdef __linux__
-#include "linux_src/LinuxLib.cpp"
+#include "linux_src/CaptureLog.h"
 #include "linux_src/LinuxLib.h"
-#include "linux_src/SerialPort_linux.cpp"
 #include "linux_src/SerialPort_linux.h"
+#include "linux_src/EventLoop_linux.h"
+#include "linux_src/FrameRing.h"
+#include "linux_src/PortManager_linux.h"
+#else
+#error "main.cpp waits on the serial port with epoll (EventLoop_linux)"
 #endif
 
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <iostream>
@@ -31,10 +35,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "CommandScript.h"
+#include "CommandTable.h"
+#include "DeviceRegistry.h"
+#include "Packet.h"
+#include "PollScheduler.h"
+#include "RequestTracker.h"
 #include "iProtocol.h"
 #include "userTest.h"
 
 #include <fstream>
+#include <getopt.h>
+#include <signal.h>
 
 
 using std::cin;
@@ -44,32 +56,54 @@ using std::endl;
 extern uint8_t cinNumber();
 
 /******************************************************************************/
-/* Serial port parameters */
-const char *port_name = "/dev/ttyACM0";
+/* Serial port parameters: one port per housekeeping board */
+const char *port_names[] = {
+    "/dev/ttyACM0",
+};
 int SerialBaud = 1152000;
+
+/* Integrity check each board's packets carry, if not the 1-byte sum:
+ * eIntegrityCRC16 or eIntegrityCRC32C. The board's firmware must match */
+struct board_integrity_t {
+  housekeeping_id board;
+  integrity_mode_t mode;
+} board_integrity[] = {
+    {eMainHsk, eIntegritySum},
+};
+
+/* Read the ports on their own thread (--threaded), queueing up to
+ * RX_RING_DEPTH decoded packets for the main loop. Off by default: the ports
+ * are read on the main loop, which is enough unless the packet handlers are
+ * slow (printing to a slow terminal, ...) */
+bool threadedRX = false;
+#define RX_RING_DEPTH 256
+/* Read + write the ports through io_uring instead (--io-uring, which reads
+ * them on the main loop). Falls back to epoll + read() if the kernel won't
+ * set up a ring */
+bool ioUringIO = false;
+
+/* Ask for the checksum of every packet typed in, to send a bad one on
+ * purpose (--ask-checksum). Otherwise the right one is always sent */
+bool askChecksum = false;
 /******************************************************************************/
 
 /* Name this device */
 housekeeping_id myComputer = eSFC;
 
-/* Declarations to keep track of device list */
-uint8_t downStreamDevices[254] = {0}; // Keep a list of downstream devices
-uint8_t numDevices = 0; // Keep track of how many devices are downstream
+/* Every device a packet has come from, with its statistics */
+DeviceRegistry devices;
 
 /* Keep a log of errors */
 uint8_t errorsReceived[254] = {0};
 uint8_t numErrors = 0;
 
-/* Create buffers for data */
+/* Create buffers for data. Incoming packets are decoded into their port's
+ * own buffer (see PortManager_linux.h) */
 uint8_t outgoingPacket[MAX_PACKET_LENGTH] = {0}; // Buffer for outgoing packet
-uint8_t incomingPacket[MAX_PACKET_LENGTH] = {0}; // Buffer for incoming packet
 
-/* Defining the variable here makes the linker connect where these variables
- * are being used (see iProtocol.h for declaration)	*/
-housekeeping_hdr_t *hdr_in;
-housekeeping_hdr_t *hdr_out;
-housekeeping_err_t *hdr_err;
-housekeeping_prio_t *hdr_prio;
+/* The outgoing packet is put together through this. Incoming packets are
+ * read through a PacketView over the buffer they were decoded into */
+PacketBuilder outgoing(outgoingPacket, sizeof(outgoingPacket));
 
 /* Utility variableas: */
 uint8_t checkin;         // Checksum value for read-in
@@ -78,28 +112,86 @@ uint8_t lengthBeingSent; // Actual
 uint16_t numberIN;
 std::string numbufIN;
 
-/* While connected, variables to check the how long its been since read a byte
- */
-int read_result = 0;
-std::chrono::time_point<std::chrono::system_clock> newest_zero, newest_result;
-std::chrono::duration<double> elapsed_time;
+/* Which function handles each received command (see registerCommands) */
+CommandTable commands;
+
+/* Event loop: sleeps until a port is readable or a timer expires */
+EventLoop loop;
+
+/* Every open serial port, all watched by the loop */
+PortManager ports(&loop);
+
+/* Decoded packets on their way from the reader thread (threaded mode) */
+FrameRing rxRing(RX_RING_DEPTH);
+
+/* Prompt the user again once nothing has been decoded for IDLE_TIME seconds */
+#define IDLE_TIME 0.5
+int idleTimer;
+bool idleOver = false;
+
+/* Discard an incomplete packet PACKET_TIMEOUT seconds after its last byte:
+ * four times as long as the longest frame takes on the wire (10 bits a byte),
+ * but no less than PACKET_TIMEOUT_MIN. A slower board can get its own:
+ * ports.setPacketTimeout(index, seconds) */
+#define PACKET_TIMEOUT_MIN 0.02
+#define PACKET_TIMEOUT                                                         \
+  std::max(PACKET_TIMEOUT_MIN, 4.0 * MAX_ENCODED_LENGTH * 10 / SerialBaud)
 
 /* Set up a delay */
-std::chrono::time_point<std::chrono::system_clock> timeSinceDelay;
-std::chrono::duration<double> delayed_time;
+int standbyTimer;
 bool delayOver = true;
 double userTIME;
 
 /* Bool if a reset needs to happen */
 bool needs_reset = false;
 
+/* Packets to send from --script / --command instead of prompting the user */
+CommandScript script;
+bool scripted = false;
+int scriptTimer;
+
+/* Try again SCRIPT_RETRY seconds later when a port's transmit queue is full */
+#define SCRIPT_RETRY 0.01
+/* Keep handling answers for SCRIPT_LINGER seconds after the last packet */
+#define SCRIPT_LINGER 1.0
+bool scriptOver = false;
+
+/* Requests sent over and over from --poll, at their own rates */
+#define MAX_POLLS 64
+PollScheduler poller(MAX_POLLS);
+bool polling = false;
+int pollTimer;
+
+/* Requests waiting for their answer: at most --window of them open at once
+ * (REQUEST_WINDOW unless given), and at most --device-window to one device
+ * (DEVICE_WINDOW unless given; one until it has answered). Each is sent up
+ * to --retries more times, on deadlines that follow its device's round-trip
+ * time; --timeout seconds until the device has answered once */
+#define MAX_IN_FLIGHT 256
+#define REQUEST_WINDOW 8
+#define DEVICE_WINDOW 4
+RequestTracker requests(MAX_IN_FLIGHT);
+int requestTimer;
+bool scriptWaiting = false; // Script held back by a full window
+
+/* Every packet sent and decoded goes to the --capture log, if given. What
+ * is buffered goes to the disk every CAPTURE_SYNC seconds */
+#define CAPTURE_SYNC 1.0
+CaptureLog capture;
+const char *capturePath = 0;
+int captureTimer;
+
+/* Stop after --duration seconds (0: run until stopped) */
+double runTime = 0;
+int runTimer;
+
 /*******************************************************************************
  * Functions
  *******************************************************************************/
 /* Function flow:
  * --Gets outgoing header from the userTest function 'setupMyPacket'
  * --Computes the checksum of the outgoing data
- * --Asks user what checksum to use
+ * --Asks user what checksum to use, if askChecksum is set
  *
  * Function variables:
  * numbufIN:		Character buffer for user input
@@ -112,18 +204,23 @@ bool setup() {
   cout << endl;
   if (userTIME = (double)cinNumber()) {
     delayOver = false;
-    timeSinceDelay = std::chrono::system_clock::now();
+    loop.armTimer(standbyTimer, userTIME);
     return false;
   }
   delayOver = true;
 
-  lengthBeingSent = setupMyPacket(hdr_out, hdr_prio); // Fills in rest of header
+  lengthBeingSent = setupMyPacket(outgoing); // Fills in rest of header
 
-  /* Compute checksum for outgoing packet + add it to the end of packet */
-  fillChecksum((uint8_t *)outgoingPacket);
+  /* Compute checksum (or CRC) for outgoing packet + add it to the end of
+   * packet, in the integrity mode of its destination */
+  integrity_mode_t mode = getIntegrity(outgoing.header()->dst);
+  unsigned long maxTrailer = (1UL << (8 * trailerSize(mode) - 1) << 1) - 1;
+  fillTrailer((uint8_t *)outgoingPacket, mode);
+  if (!askChecksum)
+    return true;
 
   cout << "The computed checksum is "
-       << (int)outgoingPacket[4 + lengthBeingSent];
+       << readTrailer((uint8_t *)outgoingPacket, mode);
   cout << ". Enter this value, or input a different checksum to check protocol "
           "reliability.";
   cout << endl;
@@ -133,11 +230,11 @@ bool setup() {
   while (cin) {
     numberIN = strtoul(numbufIN.c_str(), 0, 10);
 
-    if (numberIN > 255) {
-      cout << "Number too big. Input a number between 0 & 255: ";
+    if (numberIN > maxTrailer) {
+      cout << "Number too big. Input a number between 0 & " << maxTrailer << ": ";
       cin >> numbufIN;
     } else {
-      outgoingPacket[4 + lengthBeingSent] = (uint8_t)numberIN;
+      writeTrailer((uint8_t *)outgoingPacket, mode, numberIN);
       break;
     }
   }
@@ -146,204 +243,626 @@ bool setup() {
 }
 
 /* Function flow:
- * --Checks to see if the packet was received from an unknown device
- *		--If so, add that device address to the list of known devices
- * --Sorts through commands & executes defined functions in myprogram.h
- * --If there is no protocol for a command, just reads header + displays data
+ * --Handlers the command table calls that need more than the header: the
+ *   incoming priority/error structs, the error log or the outgoing packet
  *
- * Function params:
- * buffer:		Pointer to the location of the incoming packet
+ */
+void onPingPong(const PacketView &packet) {
+  justReadHeader(packet);
+  cout << endl;
+}
+
+void onSetPriority(const PacketView &packet) {
+  whatToDoIfSetPriority(packet);
+}
+
+void onError(const PacketView &packet) {
+  devices.recordError(packet.src());
+  whatToDoIfError(packet, errorsReceived, numErrors);
+
+//    resetAll(outgoing);
+
+  /* Compute checksum for outgoing packet + add it to the end of packet */
+  outgoing.finish();
+//    needs_reset = true;
+}
+
+/* Any command without a handler: read the header + display the data */
+void onUnknown(const PacketView &packet) {
+  justReadHeader(packet);
+  cout << "DATA: ";
+
+  for (int i = 0; i < packet.len(); i++) {
+    cout << (int)packet.payload()[i] << " ";
+  }
+  cout << endl << endl;
+}
+
+/* An empty answer to a priority request means there was nothing to send */
+void onPriorityData(const PacketView &packet) {
+  if (packet.len() != 0) {
+    onUnknown(packet);
+    return;
+  }
+  cout << "Device #" << (int)packet.src();
+  cout << " did not have any data of this priority." << endl << endl;
+}
+
+/* Function flow:
+ * --Fills the command table at startup: which function handles each
+ *   command, from which board, and how many payload bytes it takes
+ * --A board's own commands win over the ANY_SOURCE ones, so the magnet
+ *   board's float range starts after eIntSensorRead
  *
- * Function variables:
- * downStreamDevices:		The array of addresses of known devices
- * numDevices:				Running total of downstream devices
+ */
+void registerCommands() {
+  commands.add(ANY_SOURCE, ePingPong, &onPingPong);
+  commands.add(ANY_SOURCE, eSetPriority, &onSetPriority,
+               sizeof(housekeeping_prio_t), sizeof(housekeeping_prio_t));
+  commands.add(ANY_SOURCE, eIntSensorRead, &whatToDoIfISR, 1, 4);
+  commands.add(ANY_SOURCE, eMapDevices, &whatToDoIfMap);
+  commands.addRange(ANY_SOURCE, eSendLowPriority, eSendHiPriority,
+                    &onPriorityData);
+  commands.add(ANY_SOURCE, eError, &onError, sizeof(housekeeping_err_t),
+               sizeof(housekeeping_err_t));
+
+  /* Payload lengths of the telemetry come from its schema (userTest.h) */
+  const uint8_t floatSize = float_payload_t::size;
+  commands.add(eDCTHsk, ePacketCount, &whatToDoIfThermistorsTest, floatSize,
+               floatSize);
+  commands.addRange(eMagnetHsk, 3, 13, &whatToDoIfFloat, floatSize, floatSize);
+  commands.addRange(eMagnetHsk, 14, 15, &whatToDoIfFlow, 1, 255);
+  commands.addRange(eMagnetHsk, 16, 25, &whatToDoIfTempProbes, floatSize,
+                    floatSize);
+  commands.add(eMagnetHsk, 26, &whatToDoIfPressure, 1, 255);
+
+  commands.setDefault(&onUnknown);
+}
+
+/* Function flow:
+ * --Counts the packet against the device it came from. An unknown device is
+ *   added to the registry on its first packet
+ * --Closes the request it answers, if one is open (see RequestTracker.h)
+ * --Dispatches the command through the command table. A payload of the
+ *   wrong length is reported instead of being decoded
+ *
+ * Function params:
+ * packet:		View of the incoming packet
  *
  */
-void commandCenter(const uint8_t *buffer) {
-  /* Check if the device is already known */
-  if (findMe(downStreamDevices, downStreamDevices + numDevices, hdr_in->src) ==
-      downStreamDevices + numDevices) {
-    /* If not, add it to the list of known devices */
-    downStreamDevices[numDevices] = hdr_in->src;
-    numDevices += 1;
+void commandCenter(const PacketView &packet) {
+  uint64_t now = DeviceRegistry::now();
+
+  devices.recordPacket(packet.src(), packet.size(), now);
+  requests.answered(packet, now);
+
+  if (commands.dispatch(packet) == EBADLEN) {
+    const command_entry_t *entry = commands.find(packet.src(), packet.cmd());
+    cout << "Device #" << (int)packet.src() << " sent " << (int)packet.len()
+         << " bytes for command #" << (int)packet.cmd() << ", expected "
+         << (int)entry->minLength;
+    if (entry->maxLength != entry->minLength)
+      cout << " to " << (int)entry->maxLength;
+    cout << endl << endl;
   }
+}
 
-  /* Check commands */
-  if (hdr_in->cmd == ePingPong) {
-    justReadHeader(hdr_in);
+/* Function flow:
+ * --Called when a packet is received by the serial port instance
+ * --The port manager already checked it while it was decoded (length,
+ *   checksum, destination), so a good packet goes straight to the
+ *   commandCenter and a bad one is only reported
+ *
+ * Function params:
+ * packet:		View of the decoded incoming packet
+ * status:		What checkPacket() found
+ *
+ */
+void checkHdr(const PacketView &packet, packet_status_t status) {
+  switch (status) {
+  case ePacketOK:
+    commandCenter(packet);
+    break;
+
+  case ePacketBadChecksum:
+    devices.recordChecksumFailure(packet.src());
+    cout << "Bummer, checksum did not match." << endl;
+    cout << "Length of data is " << (int)packet.len() << endl;
+    cout << "checksum is " << (int)packet.data()[packet.size() - 1] << endl;
+    break;
+
+  case ePacketBadLength:
+    cout << "Bad packet length: " << packet.size() << " bytes decoded";
+    if (packet.size() >= 4)
+      cout << ", header says "
+           << 4 + packet.len() + trailerSize(getIntegrity(packet.src()));
     cout << endl;
-  } else if (hdr_in->cmd == eSetPriority) {
-    whatToDoIfSetPriority(hdr_in, hdr_prio);
-  } else if (hdr_in->cmd == eIntSensorRead) {
-    whatToDoIfISR(hdr_in);
-  } else if (hdr_in->cmd == 7 && hdr_in->src == 3) {
-    whatToDoIfThermistorsTest(hdr_in);
-  } else if ((hdr_in->cmd >=2 && hdr_in->cmd<=13) && hdr_in->src == 2) {
-    whatToDoIfFloat(hdr_in);
-  } else if ((hdr_in->cmd ==14 || hdr_in->cmd==15) && hdr_in->src == 2) {
-    whatToDoIfFlow(hdr_in);
-  } else if ((hdr_in->cmd >=16 && hdr_in->cmd <=25) && hdr_in->src == 2) {
-    whatToDoIfTempProbes(hdr_in);
-  } else if (hdr_in->cmd ==26 && hdr_in->src == 2) {
-    whatToDoIfPressure(hdr_in);
-  } else if (hdr_in->cmd == eMapDevices) {
-    whatToDoIfMap(hdr_in);
-  } else if ((int)hdr_in->cmd < eSendAll &&
-             (int)hdr_in->cmd >= eSendLowPriority && hdr_in->len == 0) {
-    cout << "Device #" << (int)hdr_in->src;
-    cout << " did not have any data of this priority." << endl << endl;
-  } else if (hdr_in->cmd == eError) {
-    whatToDoIfError(hdr_err, errorsReceived, numErrors);
-
-//    resetAll(hdr_out);
+    break;
+
+  /* If it wasn't meant for us, cast it as an error & restart */
+  case ePacketBadDest:
+    cout << "Bad destination received... Restarting downstream devices."
+         << endl;
+
+//    resetAll(outgoing);
 
     /* Compute checksum for outgoing packet + add it to the end of packet */
-    fillChecksum((uint8_t *)outgoingPacket);
+    outgoing.finish();
 //    needs_reset = true;
-  } else {
-    justReadHeader(hdr_in);
-    cout << "DATA: ";
+    break;
+  }
+}
 
-    for (int i = 0; i < hdr_in->len; i++) {
-      cout << (int)*((uint8_t *)hdr_in + 4 + i) << " ";
-    }
-    cout << endl << endl;
+/* Function flow:
+ * --Restarts the idle clock: the user is prompted again IDLE_TIME seconds
+ *   from now unless another packet is decoded first
+ *
+ */
+void restartIdleTimer() {
+  idleOver = false;
+  loop.armTimer(idleTimer, IDLE_TIME);
+}
+
+/* Function flow:
+ * --Closes the requests whose deadline passed, then sleeps until the next
+ *   deadline
+ *
+ */
+void requestTimedOut(void *context, int timer) {
+  double wait = requests.run(DeviceRegistry::now());
+  if (wait > 0)
+    loop.armTimer(requestTimer, wait);
+}
+
+/* Function flow:
+ * --Called by the request tracker to send a request again: to the port its
+ *   destination lives on, like the first time
+ *
+ */
+bool resendRequest(void *context, const uint8_t *packet, size_t size) {
+  return ports.send(PacketView(packet, size).dst(), (uint8_t *)packet, size);
+}
+
+/* Function flow:
+ * --Sends the outgoing packet and opens a request for its answer
+ * --Re-arms the deadline clock for the earliest open deadline: each
+ *   device has its own RTO, so a new request can be due before the ones
+ *   already open
+ * --Returns FALSE if the window (or its device's) is full or no port took
+ *   the packet
+ *
+ * Function params:
+ * size:		Size of the outgoing packet, trailer included
+ *
+ */
+bool sendRequest(size_t size) {
+  uint8_t dst = outgoing.header()->dst;
+  uint64_t now = DeviceRegistry::now(); // Round trip includes the write
+
+  if (dst != eBroadcast && !requests.canSend(dst))
+    return false;
+  if (!ports.send(dst, outgoingPacket, size))
+    return false;
+
+  if (requests.sent(outgoingPacket, size, now) >= 0)
+    requestTimedOut(0, requestTimer);
+  return true;
+}
+
+/* Function flow:
+ * --Called by the request tracker as each request is answered or given up
+ *   on. Only a timeout is worth printing: the answer itself was handled by
+ *   the command table
+ * --A request closed makes room in the window: a script waiting on it
+ *   sends its next packet
+ * --Once a finished script's last request is closed, the run is over
+ * --Prompting the user, the last answer in brings the prompt back within
+ *   the device's RTO rather than IDLE_TIME, if that is sooner
+ *
+ */
+void requestDone(void *context, const request_t &request,
+                 request_status_t status) {
+  if (status == eRequestTimedOut)
+    cout << "No answer from device #" << (int)request.dst << " to command #"
+         << (int)request.cmd << " after " << (int)request.tries << " tries"
+         << endl;
+
+  if (!scripted && !polling && requests.inFlight() == 0) {
+    idleOver = false;
+    loop.armTimer(idleTimer, std::min(IDLE_TIME, requests.rto(request.dst)));
   }
+
+  if (scriptWaiting) {
+    scriptWaiting = false;
+    loop.armTimer(scriptTimer, 1e-9);
+  }
+  if (scriptOver && requests.inFlight() == 0)
+    loop.stop();
 }
 
 /* Function flow:
- * --Called when a packet is received by the serial port instance
- * --Checks to see if the packet is meant for this device
- *		--If so, check the checksum for data corruption +
- *		  execute the command in the header
+ * --Prompts the user for the next packet once the ports have been idle long
+ *   enough and any standby delay is over
+ * --Sends the packet to the port its destination lives on, or starts the
+ *   standby delay the user asked for
+ *
+ */
+void promptUser() {
+  if (!idleOver || !delayOver)
+    return;
+
+  /* Check if a reset needs to be sent */
+  if (needs_reset) {
+    ports.send(outgoing.header()->dst, outgoingPacket, outgoing.size());
+    needs_reset = false;
+    loop.stop();
+    return;
+  }
+
+  /* If it doesn't, prompt the user again for packet params  */
+  if (setup()) {
+    /* Send out the header and packet*/
+    sendRequest(outgoing.size());
+
+    /* Reset the timing system */
+    restartIdleTimer();
+  }
+}
+
+/* Function flow:
+ * --Called by the port manager for each packet decoded on any port
+ * --Restarts the idle clock, then checks + executes the packet through a
+ *   view over the port's buffer. Nothing is copied
  *
  * Function params:
+ * sender:		The SerialPort the packet arrived on
  * buffer:		Pointer to the location of the incoming packet
  * len:			Size of the decoded incoming packet
+ * status:		What checkPacket() found
  *
- * Function variables:
- * checkin:		Utility variable to store a checksum in
+ */
+void packetFromPort(const void *sender, const uint8_t *buffer, size_t len,
+                    packet_status_t status) {
+  restartIdleTimer();
+  checkHdr(PacketView(buffer, len), status);
+}
+
+/* Function flow:
+ * --Prints what each device that sent a good packet sent this run
  *
  */
-void checkHdr(const uint8_t *buffer, size_t len) {
-  /* Check if the message was intended for this device
-   * If it was, check and execute the command  */
-  if (hdr_in->dst == myComputer) {
-    if (verifyChecksum((uint8_t *)buffer)) {
-      commandCenter(buffer);
-    } else{
-        cout << "Bummer, checksum did not match." << endl;
-        cout << "Length of data is " << (int) hdr_in->len << endl;
-        uint8_t * p= buffer;
-        cout << "first byte " << (int) *p << endl;
-        housekeeping_hdr_t* hdr = (housekeeping_hdr_t*) p;
-        uint8_t* data = p + sizeof(housekeeping_hdr_t);
-        uint8_t* cksum = data + hdr->len;
-        uint8_t sum = 0;
-        for (; p <= cksum; p++) sum += *p;
-        cout << "checksum and calculated are: " << (int) *cksum << "," << (int) sum << endl;
-      }
+void printDevices() {
+  uint64_t now = DeviceRegistry::now();
+
+  cout << devices.count() << " device(s) seen" << endl;
+  for (int address = 0; address < 256; address++) {
+    if (!devices.known(address))
+      continue;
+    device_stats_t stats = devices.stats(address);
+    cout << "Device #" << address << ": " << stats.packets << " packets, "
+         << stats.bytes << " bytes, " << stats.checksumFailures
+         << " checksum failures, " << stats.errors << " errors, last seen "
+         << (now - stats.lastSeen) / 1e9 << " s ago" << endl;
   }
+}
 
-  /* If it wasn't, cast it as an error & restart */
-  else {
-    cout << "Bad destination received... Restarting downstream devices."
-         << endl;
+/* Function flow:
+ * --Called by the event loop whenever the script's next packet is due
+ * --Sends every packet due now, then sleeps until the next one. Incoming
+ *   packets are handled in between, as the loop keeps running
+ * --A full request window holds the packet until an answer (or timeout)
+ *   makes room (see requestDone()). A full transmit queue leaves it for
+ *   SCRIPT_RETRY seconds later
+ * --Once the script is over, waits for the answers to its open requests,
+ *   or SCRIPT_LINGER seconds if it has none, then stops the loop
+ *
+ */
+void scriptTimedOut(void *context, int timer) {
+  if (scriptOver) {
+    loop.stop();
+    return;
+  }
 
-//    resetAll(hdr_out);
+  while (!script.done()) {
+    size_t size = script.fill(outgoing, myComputer);
 
-    /* Compute checksum for outgoing packet + add it to the end of packet */
-    fillChecksum((uint8_t *)outgoingPacket);
-//    needs_reset = true;
+    if (size && outgoing.header()->dst != eBroadcast &&
+        !requests.canSend(outgoing.header()->dst)) {
+      scriptWaiting = true;
+      return;
+    }
+    if (size && !sendRequest(size)) {
+      loop.armTimer(scriptTimer, SCRIPT_RETRY);
+      return;
+    }
+
+    double delay = script.advance();
+    if (delay > 0) {
+      loop.armTimer(scriptTimer, delay);
+      return;
+    }
   }
+
+  scriptOver = true;
+  if (requests.inFlight() == 0)
+    loop.armTimer(scriptTimer, SCRIPT_LINGER);
+}
+
+/* Function flow:
+ * --Called by the poll scheduler for each request that is due
+ * --Sends it with an empty payload and the trailer its destination expects
+ * --Returns FALSE if the request window is full or no port could take it
+ *
+ */
+bool pollSend(void *context, uint8_t dst, uint8_t cmd) {
+  outgoing.setHeader(myComputer, dst, cmd, 0);
+  return sendRequest(outgoing.finish());
+}
+
+/* Called by the event loop when the next poll is due: sends every request
+ * due by now, then sleeps until the next */
+void pollTimedOut(void *context, int timer) {
+  double wait = poller.run(DeviceRegistry::now());
+  if (wait > 0)
+    loop.armTimer(pollTimer, wait);
+}
+
+/* Called by the event loop once --duration is up */
+void runTimedOut(void *context, int timer) { loop.stop(); }
+
+/* Called by the event loop every CAPTURE_SYNC seconds while capturing */
+void captureTimedOut(void *context, int timer) {
+  capture.sync();
+  loop.armTimer(captureTimer, CAPTURE_SYNC);
+}
+
+/* Ctrl-C in a script or poll run stops the loop, so the totals are printed */
+void stopOnSignal(int signal) { loop.stop(); }
+
+/* Called by the event loop when nothing has been decoded for IDLE_TIME.
+ * A script or the poll scheduler sends on its own clock instead of
+ * prompting */
+void idleTimedOut(void *context, int timer) {
+  idleOver = true;
+  if (!scripted && !polling)
+    promptUser();
+}
+
+/* Function flow:
+ * --Reads a --poll argument, DST:CMD:HZ, and adds it to the scheduler
+ * --Returns FALSE if it's malformed or the scheduler won't take it
+ *
+ */
+bool addPoll(const char *arg) {
+  unsigned dst, cmd;
+  double rate;
+  char end;
+
+  if (sscanf(arg, "%u:%u:%lf%c", &dst, &cmd, &rate, &end) != 3 || dst > 255 ||
+      cmd > 255 || poller.add(dst, cmd, rate) < 0) {
+    cout << "Bad --poll " << arg << ": expected DST:CMD:HZ, at most "
+         << MAX_POLLS << " of them, at " << 1 / POLL_TICK << " Hz or less"
+         << endl;
+    return false;
+  }
+  polling = true;
+  return true;
+}
+
+/* Function flow:
+ * --Reads the command line: scripts to run instead of prompting, and
+ *   whether to ask for checksums
+ * --Returns FALSE (after the usage) if it's wrong
+ *
+ */
+bool readOptions(int argc, char **argv) {
+  static const struct option options[] = {
+      {"script", required_argument, 0, 's'},
+      {"command", required_argument, 0, 'c'},
+      {"ask-checksum", no_argument, 0, 'a'},
+      {"poll", required_argument, 0, 'p'},
+      {"jitter", required_argument, 0, 'j'},
+      {"duration", required_argument, 0, 'd'},
+      {"window", required_argument, 0, 'w'},
+      {"device-window", required_argument, 0, 'W'},
+      {"timeout", required_argument, 0, 't'},
+      {"retries", required_argument, 0, 'r'},
+      {"capture", required_argument, 0, 'C'},
+      {"threaded", no_argument, 0, 'T'},
+      {"io-uring", no_argument, 0, 'u'},
+      {0, 0, 0, 0}};
+  int option;
+
+  while ((option = getopt_long(argc, argv, "s:c:", options, 0)) != -1) {
+    switch (option) {
+    case 's':
+      if (!script.load(optarg))
+        return false;
+      scripted = true;
+      break;
+    case 'c':
+      if (!script.parse(optarg, "--command"))
+        return false;
+      scripted = true;
+      break;
+    case 'a':
+      askChecksum = true;
+      break;
+    case 'p':
+      if (!addPoll(optarg))
+        return false;
+      break;
+    case 'j':
+      poller.setJitter(atof(optarg));
+      break;
+    case 'd':
+      runTime = atof(optarg);
+      break;
+    case 'w':
+      if (!requests.setWindow(atoi(optarg))) {
+        cout << "--window must be 1 to " << MAX_IN_FLIGHT << endl;
+        return false;
+      }
+      break;
+    case 'W':
+      if (!requests.setDeviceWindow(atoi(optarg))) {
+        cout << "--device-window must be 1 to " << MAX_IN_FLIGHT << endl;
+        return false;
+      }
+      break;
+    case 't':
+      requests.setTimeout(atof(optarg));
+      break;
+    case 'r':
+      requests.setRetries(atoi(optarg));
+      break;
+    case 'C':
+      capturePath = optarg;
+      break;
+    case 'T':
+      threadedRX = true;
+      ioUringIO = false;
+      break;
+    case 'u':
+      ioUringIO = true;
+      threadedRX = false;
+      break;
+    default:
+      cout << "usage: " << argv[0]
+           << " [--script FILE] [--command 'DST CMD [BYTES] [repeat N] "
+              "[every S] [checksum V]; ...'] [--ask-checksum]\n"
+              "       [--poll DST:CMD:HZ ...] [--jitter FRACTION] "
+              "[--duration S]\n"
+              "       [--window N] [--device-window N] [--timeout S] [--retries N]\n"
+              "       [--capture FILE] [--threaded | --io-uring]"
+           << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Called by the event loop when the user's standby delay is over */
+void standbyTimedOut(void *context, int timer) {
+  delayOver = true;
+  promptUser();
 }
 
 /*******************************************************************************
  * Main program
  *******************************************************************************/
-int main() {
+int main(int argc, char **argv) {
+  requests.setWindow(REQUEST_WINDOW);
+  requests.setDeviceWindow(DEVICE_WINDOW);
+  if (!readOptions(argc, argv))
+    return 1;
 
 //  ofstream myfile;
 //  myfile.open("bugs_test.txt");
-  /* Point to data in a way that it can be read as known data structures */
-  hdr_in = (housekeeping_hdr_t *)incomingPacket;
-  hdr_out = (housekeeping_hdr_t *)outgoingPacket;
-  hdr_err = (housekeeping_err_t *)(incomingPacket + 4);
-  hdr_prio = (housekeeping_prio_t *)(incomingPacket + 4);
-
   /* Create the header for the first message */
-  hdr_out->src = myComputer; // Source of data packet
-
-  /* Declare an instance of the serial port connection */
-  SerialPort TM4C(port_name, SerialBaud);
+  outgoing.header()->src = myComputer; // Source of data packet
+
+  /* Open every serial port, then give the boards time to wake up */
+  if (threadedRX && !ports.useReaderThread(&rxRing))
+    cout << "ERROR, could not set up the reader thread" << endl;
+  else if (!threadedRX && ioUringIO)
+    ports.useIoUring();
+  for (size_t i = 0; i < sizeof(port_names) / sizeof(port_names[0]); i++) {
+    if (ports.addPort(port_names[i], SerialBaud) < 0)
+      cout << "ERROR, check port name " << port_names[i] << endl;
+  }
 
-  /* Check if connection is established */
-  if (TM4C.isConnected())
+  /* Check if a connection is established */
+  if (ports.numPorts() > 0)
     cout << "Connection Established" << endl;
   else {
-    cout << "ERROR, check port name";
+    cout << "ERROR, no port could be opened";
     return 0;
   }
+  ports.waitForBoards();
 
   /* Set the function that will act when a packet is received */
-  TM4C.setPacketHandler(&checkHdr);
+  registerCommands();
+  ports.setPacketHandler(&packetFromPort);
+  ports.setAddress(myComputer);
+  for (size_t i = 0; i < sizeof(board_integrity) / sizeof(board_integrity[0]); i++)
+    setIntegrity(board_integrity[i].board, board_integrity[i].mode);
+  ports.setPacketTimeout(PACKET_TIMEOUT);
+
+  /* Wake up when one of the clocks runs out */
+  idleTimer = loop.addTimer(&idleTimedOut, 0);
+  standbyTimer = loop.addTimer(&standbyTimedOut, 0);
+  scriptTimer = loop.addTimer(&scriptTimedOut, 0);
+  pollTimer = loop.addTimer(&pollTimedOut, 0);
+  runTimer = loop.addTimer(&runTimedOut, 0);
+  requestTimer = loop.addTimer(&requestTimedOut, 0);
+  captureTimer = loop.addTimer(&captureTimedOut, 0);
+  if (idleTimer < 0 || standbyTimer < 0 || scriptTimer < 0 || pollTimer < 0 ||
+      runTimer < 0 || requestTimer < 0 || captureTimer < 0) {
+    cout << "ERROR, could not set up the event loop";
+    return 0;
+  }
+
+  /* Record from the first packet on */
+  if (capturePath) {
+    if (!capture.open(capturePath))
+      return 1;
+    ports.setCapture(&capture);
+    loop.armTimer(captureTimer, CAPTURE_SYNC);
+  }
 
   /* Start up your program & set the outgoing packet data + send it out */
-  startUp(hdr_out);
-  fillChecksum((uint8_t *)outgoingPacket);
-  TM4C.send(outgoingPacket, 4 + hdr_out->len + 1);
+  requests.setDoneFunction(&requestDone, 0);
+  requests.setSendFunction(&resendRequest, 0);
+  startUp(outgoing);
+  sendRequest(outgoing.finish());
 
   /* On startup: Reset number of found devices & errors to 0 */
-  memset(downStreamDevices, 0, numDevices);
-  numDevices = 0;
+  devices.reset();
   memset(errorsReceived, 0, numErrors);
   numErrors = 0;
 
-  /* Initialize timing variables for when the last message was received */
-  newest_zero = std::chrono::system_clock::now();
-  newest_result = std::chrono::system_clock::now();
-
-  /* While the serial port is open, */
-  while (TM4C.isConnected()) {
-    /* Reads in 1 byte at a time until the full packet arrives.
-     * If a full packet is received, update will execute PacketReceivedFunction
-     * If no full packet is received, bytes are discarded   */
-    read_result = TM4C.update(incomingPacket);
-
-    /* If a packet was decoded, mark down the time it happened */
-    if (read_result > 0)
-      newest_result = std::chrono::system_clock::now();
-
-    /* If a packet wasn't decoded in this run, write down the current time */
-    else
-      newest_zero = std::chrono::system_clock::now();
-
-    /* Using the above variable definitions, calculate how long its been since
-     * something has been decoded */
-    elapsed_time = newest_zero - newest_result;
-    delayed_time = std::chrono::system_clock::now() - timeSinceDelay;
-    if (delayed_time.count() > userTIME) {
-      delayOver = true;
-    }
-
-    /* If that ^ time is greater than 1/2 a second, prompt the user again */
-    if (elapsed_time.count() > .5 && delayOver) {
-      /* Check if a reset needs to be sent */
-      if (needs_reset) {
-        TM4C.send(outgoingPacket, 4 + hdr_out->len + 1);
-        needs_reset = false;
-        return 0;
-      }
+  /* Start the clock for when the last message was received */
+  restartIdleTimer();
+  if (scripted)
+    loop.armTimer(scriptTimer, SCRIPT_RETRY);
+  if (polling) {
+    poller.setSendFunction(&pollSend, 0);
+    poller.start(DeviceRegistry::now());
+    pollTimedOut(0, pollTimer);
+  }
+  if (runTime > 0)
+    loop.armTimer(runTimer, runTime);
+  if (scripted || polling) {
+    signal(SIGINT, stopOnSignal);
+    signal(SIGTERM, stopOnSignal);
+  }
+  ports.startReaderThread();
 
-      /* If it doesn't, prompt the user again for packet params  */
-      if (setup()) {
-        /* Send out the header and packet*/
-        TM4C.send(outgoingPacket, 4 + lengthBeingSent + 1);
+  /* While a serial port is open, sleep until there is something to do */
+  loop.run();
+  ports.stopReaderThread();
 
-        /* Reset the timing system */
-        newest_zero = std::chrono::system_clock::now();
-        newest_result = std::chrono::system_clock::now();
-      }
-    }
+  if (ports.getRing()) {
+    FrameRing *ring = ports.getRing();
+    cout << "Reader thread queued " << ring->pushed() << " packets (ring depth "
+         << ring->depth() << ", most queued at once " << ring->highWater()
+         << ", dropped " << ring->overflows() << ")" << endl;
+  }
+  cout << "Port I/O took " << ports.ioSyscalls() << " system calls"
+       << (ports.usingIoUring() ? " (io_uring)" : "") << endl;
+  if (scripted)
+    cout << "Script sent " << script.packetsSent() << " packets" << endl;
+  if (polling)
+    poller.report(stdout);
+  if (requests.stats().sent > 0)
+    requests.report(stdout);
+  if (capture.isOpen()) {
+    ports.setCapture(0);
+    capture.close();
+    cout << "Captured " << capture.frames() << " packets to " << capturePath
+         << " (" << capture.bytes() << " bytes, " << capture.dropped()
+         << " lost)" << endl;
   }
+  printDevices();
 }
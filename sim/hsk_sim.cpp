@@ -0,0 +1,714 @@
+/*
+ * hsk_sim.cpp
+ *
+ * Simulates housekeeping boards on pseudo-terminals, so main.cpp (or any
+ * other host) can be run against them on any Linux box instead of real
+ * LaunchPads. Each board gets its own pty pair; the host opens the slave
+ * side (printed at startup) like it would /dev/ttyACM0.
+ *
+ * Boards answer:
+ *	--ePingPong, eSetPriority, eIntSensorRead, eMapDevices, ePacketCount
+ *	--eTestMode: payload [n, x] starts a burst of n frames, each carrying
+ *	  [n, x], [n - 1, x], ... like the LaunchPad test firmware
+ *	  (see debug_testmode.txt); n = 0 asks for 250
+ *	--eSendLow/Med/HiPriority, eSendAll: every reading set to that priority
+ *	--eReset
+ *	--Their telemetry, laid out by the schemas in userTest.h: MagnetHsk
+ *	  3-13 + 16-25 float, 14-15 flow, 26 pressure; DCTHsk 7 thermistor
+ *	--Anything else with an eError (EBADCOMMAND, or EBADLEN for a bad
+ *	  eSetPriority)
+ *
+ * Build + run from the repository root:
+ *	make hsk_sim
+ *	build/hsk_sim --link /tmp/ttyHSK		(boards appear as /tmp/ttyHSK1, 2, 3)
+ *
+ * Options:
+ *	--boards 1,2,3		Which boards to simulate (MainHsk, MagnetHsk, DCTHsk)
+ *	--rate FPS			Frames per second per board for test mode bursts and
+ *						streaming. 0 (default): as fast as the pty takes them
+ *	--payload N			Payload bytes of test mode / streamed frames (2)
+ *	--stream			Send test mode frames nonstop without being asked
+ *	--corrupt P			Corrupt each frame sent with probability P: a flipped
+ *						bit, a dropped byte or a stray PACKETMARKER
+ *	--integrity MODE	sum (default), crc16 or crc32c, for every board
+ *	--host ADDRESS		Address replies and streams go to (252, eSFC)
+ *	--duration S		Exit after S seconds
+ *	--seed N			Seed for the readings and the corruption
+ *	--link PREFIX		Symlink each board's pty to PREFIX<address>
+ *
+ */
+
+#include "../COBS.h"
+#include "../Packet.h"
+#include "../iProtocol.h"
+#include "../userTest.h"
+#include "../linux_src/EventLoop_linux.h"
+#include "../linux_src/SerialPort_linux.h"	// MAX_PACKET_LENGTH, MAX_ENCODED_LENGTH
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* define MAX_BOARDS for the most boards one simulator runs */
+#define MAX_BOARDS 8
+/* define TX_BUFFER for the bytes a board can have waiting for the pty */
+#define TX_BUFFER (1 << 20)
+/* define TX_LOW_WATER for when a flat-out board makes more frames */
+#define TX_LOW_WATER (64 * 1024)
+/* define PACE_TICK for the longest gap between paced frames, in seconds */
+#define PACE_TICK 0.001
+
+/* What a board sends back for a reading command */
+typedef enum sensor_kind
+{
+	eNoSensor = 0,
+	eFloatSensor = 1,		// float_payload_t
+	ePressureSensor = 2,	// pressure_payload_t + status byte
+	eFlowSensor = 3,		// flow_payload_t + status byte
+	eThermistor = 4			// float_payload_t, in ohms
+} sensor_kind_t;
+
+/* Corruption kinds, for the statistics */
+typedef enum corruption
+{
+	eFlippedBit = 0,
+	eDroppedByte = 1,
+	eStrayMarker = 2
+} corruption_t;
+
+/* One simulated board and its pty */
+struct Board
+{
+	housekeeping_id address;
+	const char * name;
+	int master;
+	int slave;					// Held open (raw) so the pty never hangs up
+	char path[64];
+	char link[128];
+
+	COBSDecoder decoder;
+	uint8_t rx[MAX_PACKET_LENGTH];
+
+	/* Encoded bytes waiting for the pty: [txStart, txEnd) */
+	uint8_t * tx;
+	size_t txStart;
+	size_t txEnd;
+	bool writeWatched;
+
+	/* Board state */
+	sensor_kind_t sensors[256];
+	uint8_t priority[256];
+	uint32_t packetsReceived;
+	uint32_t burstLeft;			// Test mode frames still to send
+	uint8_t burstArg;
+	uint32_t frameNumber;
+
+	/* Pacing */
+	int paceTimer;
+	double paceStart;
+	uint64_t paced;
+
+	/* Statistics */
+	uint64_t received;
+	uint64_t badChecksum;
+	uint64_t badLength;
+	uint64_t sent;
+	uint64_t corrupted[3];
+	uint64_t bytesSent;
+};
+
+/* Settings */
+static double rate = 0;
+static int payloadSize = 2;
+static bool streaming = false;
+static double corruptRate = 0;
+static integrity_mode_t integrityMode = eIntegritySum;
+static uint8_t hostAddress = eSFC;
+static double duration = 0;
+
+static EventLoop loop;
+static Board boards[MAX_BOARDS];
+static int numBoards = 0;
+
+/*****************************************************************************
+ * Helpers
+ ****************************************************************************/
+static double nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double random01()
+{
+	return rand() / ((double) RAND_MAX + 1);
+}
+
+static void stopOnSignal(int signal)
+{
+	loop.stop();
+}
+
+/*****************************************************************************
+ * Transmit
+ ****************************************************************************/
+static void watchWrites(Board & board, bool watch)
+{
+	if (board.writeWatched == watch) return;
+	board.writeWatched = watch;
+	loop.modifyFd(board.master, watch ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+/* Function flow:
+ * --Writes as much of the board's waiting bytes as the pty takes
+ * --Watches for the pty to become writable again if it filled up
+ *
+ */
+static void flushBoard(Board & board)
+{
+	while (board.txStart < board.txEnd)
+	{
+		ssize_t n = write(board.master, board.tx + board.txStart, board.txEnd - board.txStart);
+		if (n > 0)
+		{
+			board.txStart += n;
+			board.bytesSent += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		break;
+	}
+	if (board.txStart == board.txEnd) board.txStart = board.txEnd = 0;
+	watchWrites(board, board.txStart < board.txEnd);
+}
+
+/* Function flow:
+ * --Fills in the trailer for the host, corrupts the packet if the dice say
+ *   so, COBS encodes it and queues it for the pty
+ * --Returns FALSE if the transmit buffer is full
+ *
+ */
+static bool queuePacket(Board & board, const PacketBuilder & packet)
+{
+	uint8_t * encoded;
+	size_t size = packet.finish();
+	int corruption = -1;
+
+	if (board.txEnd + MAX_ENCODED_LENGTH > TX_BUFFER)
+	{
+		memmove(board.tx, board.tx + board.txStart, board.txEnd - board.txStart);
+		board.txEnd -= board.txStart;
+		board.txStart = 0;
+		if (board.txEnd + MAX_ENCODED_LENGTH > TX_BUFFER) return false;
+	}
+
+	if (corruptRate > 0 && random01() < corruptRate)
+	{
+		corruption = rand() % 3;
+		if (corruption == eFlippedBit) packet.data()[rand() % size] ^= 1 << (rand() % 8);
+		else if (corruption == eDroppedByte) size--;
+	}
+
+	encoded = board.tx + board.txEnd;
+	size_t encodedSize = COBS::encode(packet.data(), size, encoded);
+	if (corruption == eStrayMarker && encodedSize > 2)
+	{
+		encoded[1 + rand() % (encodedSize - 2)] = PACKETMARKER;
+	}
+	if (corruption >= 0) board.corrupted[corruption]++;
+
+	board.txEnd += encodedSize;
+	board.sent++;
+	return true;
+}
+
+/*****************************************************************************
+ * Replies
+ ****************************************************************************/
+static void startReply(Board & board, const PacketBuilder & packet, uint8_t dst,
+                       uint8_t cmd, uint8_t len)
+{
+	packet.setHeader(board.address, dst, cmd, len);
+}
+
+/* Function flow:
+ * --Reports an error about a packet back to its sender, in the layout
+ *   whatToDoIfError reads: the header of the bad packet + the error code
+ *
+ */
+static void sendError(Board & board, const PacketView & request, int error)
+{
+	uint8_t buffer[MAX_PACKET_LENGTH];
+	PacketBuilder packet(buffer, sizeof(buffer));
+
+	startReply(board, packet, request.src(), eError, sizeof(housekeeping_err_t));
+	packet.error()->src = request.src();
+	packet.error()->dst = request.dst();
+	packet.error()->cmd = request.cmd();
+	packet.error()->error = (uint8_t)(256 + error);
+	queuePacket(board, packet);
+}
+
+/* Function flow:
+ * --Makes up a plausible reading for a sensor command: slow sines with a
+ *   little noise, different for every command
+ * --Returns the payload length
+ *
+ */
+static uint8_t makeReading(Board & board, uint8_t cmd, uint8_t * payload)
+{
+	double t = nowSeconds();
+	double wobble = sin(t * 0.5 + cmd) + 0.01 * (random01() - 0.5);
+
+	switch (board.sensors[cmd])
+	{
+		case eFloatSensor:
+			return float_payload_t::encode(payload, { (float)(20 + cmd + wobble) });
+
+		case eThermistor:
+			return float_payload_t::encode(payload, { (float)(10000 + 200 * wobble) });
+
+		case ePressureSensor:
+		{
+			size_t len = pressure_payload_t::encode(payload, { 101.325 + wobble, 22.5 + wobble, 'A' });
+			payload[len] = 0;	// status: OK
+			return len + 1;
+		}
+
+		case eFlowSensor:
+		{
+			size_t len = flow_payload_t::encode(payload,
+			    { 1.0 + wobble, 2.0 + wobble, 3.0 + wobble, 4.0 + wobble,
+			      cmd == 14 ? "N2" : "Ar" });
+			payload[len] = 0;	// status: OK
+			return len + 1;
+		}
+
+		default:
+			return 0;
+	}
+}
+
+/* Function flow:
+ * --Answers a command that reads something: a sensor of this board, the
+ *   internal temperature sensor or the packet count
+ * --Returns FALSE if the command doesn't read anything on this board
+ *
+ */
+static bool sendReading(Board & board, uint8_t dst, uint8_t cmd)
+{
+	uint8_t buffer[MAX_PACKET_LENGTH];
+	PacketBuilder packet(buffer, sizeof(buffer));
+	uint8_t len;
+
+	if (board.sensors[cmd] != eNoSensor)
+	{
+		len = makeReading(board, cmd, packet.payload());
+	}
+	else if (cmd == eIntSensorRead)
+	{
+		/* 12-bit ADC count of the TM4C's internal sensor, around 25 C */
+		len = Schema<Field<uint16_t, 0>>::encode(packet.payload(), { (uint16_t)(1800 + rand() % 16) });
+	}
+	else if (cmd == ePacketCount)
+	{
+		len = Schema<Field<uint32_t, 0>>::encode(packet.payload(), { board.packetsReceived });
+	}
+	else return false;
+
+	startReply(board, packet, dst, cmd, len);
+	return queuePacket(board, packet);
+}
+
+/* Function flow:
+ * --Sends every reading whose priority matches (any set priority for
+ *   eSendAll), or an empty packet if there are none
+ *
+ */
+static void sendPriorityData(Board & board, uint8_t dst, uint8_t cmd)
+{
+	uint8_t buffer[MAX_PACKET_LENGTH];
+	PacketBuilder packet(buffer, sizeof(buffer));
+	int level = cmd - eSendLowPriority + eLowPriority;
+	int found = 0;
+
+	for (int c = 0; c < 256; c++)
+	{
+		if (board.priority[c] == eNoPriority) continue;
+		if (cmd != eSendAll && board.priority[c] != level) continue;
+		found += sendReading(board, dst, c);
+	}
+	if (!found)
+	{
+		startReply(board, packet, dst, cmd, 0);
+		queuePacket(board, packet);
+	}
+}
+
+/* Function flow:
+ * --Sends the next frame of a test mode burst (or of the stream): the
+ *   countdown, the byte the host asked with, then filler up to
+ *   --payload bytes
+ *
+ */
+static bool sendTestFrame(Board & board)
+{
+	uint8_t buffer[MAX_PACKET_LENGTH];
+	PacketBuilder packet(buffer, sizeof(buffer));
+	uint8_t * payload = packet.payload();
+
+	startReply(board, packet, hostAddress, eTestMode, payloadSize);
+	for (int i = 0; i < payloadSize; i++) payload[i] = (uint8_t)(board.frameNumber + i);
+	if (payloadSize > 0) payload[0] = board.burstLeft ? board.burstLeft : board.frameNumber;
+	if (payloadSize > 1) payload[1] = board.burstArg;
+
+	if (!queuePacket(board, packet)) return false;
+	board.frameNumber++;
+	if (board.burstLeft) board.burstLeft--;
+	return true;
+}
+
+static bool wantsFrames(const Board & board)
+{
+	return streaming || board.burstLeft > 0;
+}
+
+/* Function flow:
+ * --Makes the test mode / stream frames that are due: at --rate, as many
+ *   as the time since pacing started allows; flat out, enough to keep the
+ *   pty busy
+ * --Then writes what it can
+ *
+ */
+static void pump(Board & board)
+{
+	if (rate > 0)
+	{
+		uint64_t due = (uint64_t)((nowSeconds() - board.paceStart) * rate);
+		while (wantsFrames(board) && board.paced < due && sendTestFrame(board)) board.paced++;
+		if (!wantsFrames(board)) loop.disarmTimer(board.paceTimer);
+	}
+	else
+	{
+		while (wantsFrames(board) && board.txEnd - board.txStart < TX_LOW_WATER && sendTestFrame(board));
+	}
+	flushBoard(board);
+}
+
+static void startPacing(Board & board)
+{
+	if (rate <= 0) return;
+	board.paceStart = nowSeconds();
+	board.paced = 0;
+	double tick = 1 / rate < PACE_TICK ? PACE_TICK : 1 / rate;
+	loop.armTimer(board.paceTimer, tick, tick);
+}
+
+/*****************************************************************************
+ * Receive
+ ****************************************************************************/
+
+/* Function flow:
+ * --Called for every frame the board decodes from the host
+ * --Checks it like the host does, then answers the command
+ *
+ */
+static void frameDecoded(void * context, const uint8_t * buffer, size_t size)
+{
+	Board & board = *(Board *) context;
+	PacketView request(buffer, size);
+	uint8_t buf[MAX_PACKET_LENGTH];
+	PacketBuilder reply(buf, sizeof(buf));
+
+	switch (checkPacket(buffer, size, board.decoder.frameSum(), board.address))
+	{
+		case ePacketOK:			break;
+		case ePacketBadDest:
+			if (request.dst() != eBroadcast) return;	// For another board
+			break;
+		case ePacketBadChecksum:	board.badChecksum++; return;
+		case ePacketBadLength:
+			board.badLength++;
+			if (size >= sizeof(housekeeping_hdr_t)) sendError(board, request, EBADLEN);
+			return;
+		default:				return;	// For another board
+	}
+	board.received++;
+	board.packetsReceived++;
+
+	uint8_t cmd = request.cmd();
+	if (board.sensors[cmd] != eNoSensor)
+	{
+		sendReading(board, request.src(), cmd);
+		return;
+	}
+
+	switch (cmd)
+	{
+		case ePingPong:
+			startReply(board, reply, request.src(), ePingPong, 0);
+			queuePacket(board, reply);
+			break;
+
+		case eSetPriority:
+			if (request.len() != sizeof(housekeeping_prio_t))
+			{
+				sendError(board, request, EBADLEN);
+				break;
+			}
+			board.priority[request.priority()->command] = request.priority()->prio_type & 3;
+			startReply(board, reply, request.src(), eSetPriority, sizeof(housekeeping_prio_t));
+			*reply.priority() = *request.priority();
+			queuePacket(board, reply);
+			break;
+
+		case eIntSensorRead:
+		case ePacketCount:
+			sendReading(board, request.src(), cmd);
+			break;
+
+		case eMapDevices:
+		{
+			uint8_t len = 0;
+			if (board.address == eMainHsk)
+			{
+				for (int i = 0; i < numBoards; i++)
+				{
+					if (boards[i].address != eMainHsk) reply.payload()[len++] = boards[i].address;
+				}
+			}
+			startReply(board, reply, request.src(), eMapDevices, len);
+			queuePacket(board, reply);
+			break;
+		}
+
+		case eTestMode:
+			board.burstLeft = request.len() > 0 && request.payload()[0] ? request.payload()[0] : 250;
+			board.burstArg = request.len() > 1 ? request.payload()[1] : 0;
+			startPacing(board);
+			break;
+
+		case eSendLowPriority:
+		case eSendMedPriority:
+		case eSendHiPriority:
+		case eSendAll:
+			sendPriorityData(board, request.src(), cmd);
+			break;
+
+		case eReset:
+			memset(board.priority, 0, sizeof(board.priority));
+			board.packetsReceived = 0;
+			board.burstLeft = 0;
+			break;
+
+		default:
+			sendError(board, request, EBADCOMMAND);
+			break;
+	}
+}
+
+static void boardReady(void * context, int fd, uint32_t events)
+{
+	Board & board = *(Board *) context;
+	uint8_t bytes[4096];
+
+	if (events & EPOLLIN)
+	{
+		for (;;)
+		{
+			ssize_t n = read(fd, bytes, sizeof(bytes));
+			if (n > 0) board.decoder.feed(bytes, n);
+			else if (n < 0 && errno == EINTR) continue;
+			else break;
+		}
+	}
+	pump(board);
+}
+
+static void paceTimedOut(void * context, int timer)
+{
+	pump(*(Board *) context);
+}
+
+static void durationOver(void * context, int timer)
+{
+	loop.stop();
+}
+
+/*****************************************************************************
+ * Setup
+ ****************************************************************************/
+
+/* Function flow:
+ * --Opens a pty pair for the board, puts it in raw mode, and holds the
+ *   slave open so the master never sees a hang-up while no host is attached
+ * --Gives the board its sensors and starts watching its pty
+ * --Returns FALSE if the pty couldn't be set up
+ *
+ */
+static bool openBoard(Board & board, housekeeping_id address, const char * linkPrefix)
+{
+	struct termios tio;
+
+	board.address = address;
+	board.name = address == eMainHsk ? "MainHsk" : address == eMagnetHsk ? "MagnetHsk"
+	           : address == eDCTHsk ? "DCTHsk" : "Board";
+
+	board.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (board.master < 0 || grantpt(board.master) < 0 || unlockpt(board.master) < 0)
+	{
+		printf("error %d opening a pty: %s\n", errno, strerror(errno));
+		return false;
+	}
+	snprintf(board.path, sizeof(board.path), "%s", ptsname(board.master));
+	board.slave = open(board.path, O_RDWR | O_NOCTTY);
+	if (board.slave < 0 || tcgetattr(board.slave, &tio) < 0)
+	{
+		printf("error %d opening %s: %s\n", errno, board.path, strerror(errno));
+		return false;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(board.slave, TCSANOW, &tio);
+
+	if (linkPrefix)
+	{
+		snprintf(board.link, sizeof(board.link), "%s%d", linkPrefix, (int) address);
+		unlink(board.link);
+		if (symlink(board.path, board.link) < 0)
+		{
+			printf("error %d linking %s: %s\n", errno, board.link, strerror(errno));
+			board.link[0] = 0;
+		}
+	}
+
+	if (address == eMagnetHsk)
+	{
+		for (int c = 3; c <= 13; c++) board.sensors[c] = eFloatSensor;
+		board.sensors[14] = board.sensors[15] = eFlowSensor;
+		for (int c = 16; c <= 25; c++) board.sensors[c] = eFloatSensor;
+		board.sensors[26] = ePressureSensor;
+	}
+	if (address == eDCTHsk) board.sensors[ePacketCount] = eThermistor;
+
+	board.tx = new uint8_t[TX_BUFFER];
+	board.decoder.setOutput(board.rx, sizeof(board.rx));
+	board.decoder.setFrameHandler(&frameDecoded, &board);
+	board.paceTimer = loop.addTimer(&paceTimedOut, &board);
+
+	return board.paceTimer >= 0 && loop.addFd(board.master, EPOLLIN, &boardReady, &board);
+}
+
+static void printStats(const Board & board)
+{
+	printf("%s (%d): received %llu, bad checksum %llu, bad length %llu, sent %llu frames "
+	       "(%llu bytes), corrupted %llu flipped bit / %llu dropped byte / %llu stray marker\n",
+	       board.name, (int) board.address,
+	       (unsigned long long) board.received, (unsigned long long) board.badChecksum,
+	       (unsigned long long) board.badLength, (unsigned long long) board.sent,
+	       (unsigned long long) board.bytesSent, (unsigned long long) board.corrupted[0],
+	       (unsigned long long) board.corrupted[1], (unsigned long long) board.corrupted[2]);
+}
+
+int main(int argc, char ** argv)
+{
+	static const struct option options[] = {
+		{ "boards", required_argument, 0, 'b' },
+		{ "rate", required_argument, 0, 'r' },
+		{ "payload", required_argument, 0, 'p' },
+		{ "stream", no_argument, 0, 's' },
+		{ "corrupt", required_argument, 0, 'c' },
+		{ "integrity", required_argument, 0, 'i' },
+		{ "host", required_argument, 0, 'h' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "seed", required_argument, 0, 'S' },
+		{ "link", required_argument, 0, 'l' },
+		{ 0, 0, 0, 0 }
+	};
+	const char * boardList = "1,2,3";
+	const char * linkPrefix = 0;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", options, 0)) != -1)
+	{
+		switch (option)
+		{
+			case 'b':	boardList = optarg; break;
+			case 'r':	rate = atof(optarg); break;
+			case 'p':	payloadSize = atoi(optarg); break;
+			case 's':	streaming = true; break;
+			case 'c':	corruptRate = atof(optarg); break;
+			case 'h':	hostAddress = atoi(optarg); break;
+			case 'd':	duration = atof(optarg); break;
+			case 'S':	srand(atoi(optarg)); break;
+			case 'l':	linkPrefix = optarg; break;
+			case 'i':
+				if (!strcmp(optarg, "crc16")) integrityMode = eIntegrityCRC16;
+				else if (!strcmp(optarg, "crc32c")) integrityMode = eIntegrityCRC32C;
+				else integrityMode = eIntegritySum;
+				break;
+			default:
+				printf("usage: %s [--boards 1,2,3] [--rate FPS] [--payload N] [--stream]\n"
+				       "       [--corrupt P] [--integrity sum|crc16|crc32c] [--host ADDRESS]\n"
+				       "       [--duration S] [--seed N] [--link PREFIX]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (payloadSize < 0 || payloadSize > 255)
+	{
+		printf("--payload must be 0-255\n");
+		return 1;
+	}
+
+	setIntegrity(hostAddress, integrityMode);
+	for (const char * p = boardList; *p && numBoards < MAX_BOARDS; )
+	{
+		int address = strtol(p, (char **) &p, 10);
+		if (address <= 0 || address >= eBroadcast) break;
+		setIntegrity(address, integrityMode);
+		if (!openBoard(boards[numBoards], (housekeeping_id) address, linkPrefix)) return 1;
+		numBoards++;
+		if (*p == ',') p++;
+	}
+	if (numBoards == 0)
+	{
+		printf("No boards to simulate\n");
+		return 1;
+	}
+
+	/* Tell the host where to connect, before anything else */
+	setvbuf(stdout, 0, _IOLBF, 0);
+	for (int i = 0; i < numBoards; i++)
+	{
+		printf("%s (%d): %s%s%s\n", boards[i].name, (int) boards[i].address, boards[i].path,
+		       boards[i].link[0] ? " -> " : "", boards[i].link);
+	}
+
+	signal(SIGINT, stopOnSignal);
+	signal(SIGTERM, stopOnSignal);
+	signal(SIGPIPE, SIG_IGN);
+	if (duration > 0) loop.armTimer(loop.addTimer(&durationOver, 0), duration);
+	if (streaming)
+	{
+		for (int i = 0; i < numBoards; i++)
+		{
+			startPacing(boards[i]);
+			pump(boards[i]);
+		}
+	}
+
+	loop.run();
+
+	for (int i = 0; i < numBoards; i++)
+	{
+		printStats(boards[i]);
+		if (boards[i].link[0]) unlink(boards[i].link);
+	}
+	return 0;
+}
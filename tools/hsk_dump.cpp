@@ -0,0 +1,135 @@
+/*
+ * hsk_dump.cpp
+ *
+ * Prints a capture log written by hsk --capture (see CaptureLog.h): one line
+ * per frame with its time, port, direction, header and what checkPacket()
+ * found, or only the totals.
+ *
+ * Build + run from the repository root:
+ *	make hsk_dump
+ *	build/hsk_dump run.cap
+ *
+ * Options:
+ *	--hex				Print each frame's bytes too
+ *	--summary			Print only the totals per port and direction
+ *
+ */
+
+#include "../iProtocol.h"
+#include "../linux_src/CaptureLog.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char * statusNames[] = { "ok", "bad checksum", "bad length", "not for us" };
+
+/* Frames + bytes per port and direction, for --summary */
+static uint64_t frameCount[256][2];
+static uint64_t byteCount[256][2];
+
+/* Function flow:
+ * --Prints a record: wall-clock time to the microsecond, seconds since the
+ *   first record (monotonic), port, direction, then the header if the
+ *   frame has one
+ *
+ */
+static void printRecord(const capture_record_t * record, uint64_t first, bool hex)
+{
+	const uint8_t * frame = captureFrame(record);
+	time_t seconds = record->realtime / 1000000000ull;
+	struct tm local;
+	char stamp[32];
+
+	localtime_r(&seconds, &local);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+	printf("%s.%06u %12.6f port %u %s", stamp, (unsigned)(record->realtime % 1000000000ull / 1000),
+	       (record->monotonic - first) / 1e9, record->port,
+	       record->direction == eCaptureTx ? "TX" : "RX");
+
+	if (record->size >= sizeof(housekeeping_hdr_t))
+	{
+		const housekeeping_hdr_t * hdr = (const housekeeping_hdr_t *) frame;
+		printf(" %3u -> %3u cmd %3u len %3u", hdr->src, hdr->dst, hdr->cmd, hdr->len);
+	}
+	if (record->direction == eCaptureRx && record->status != ePacketOK)
+	{
+		printf(" (%s)", record->status < sizeof(statusNames) / sizeof(statusNames[0]) ?
+		       statusNames[record->status] : "?");
+	}
+	if (hex)
+	{
+		printf(" :");
+		for (int i = 0; i < record->size; i++) printf(" %02x", frame[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char ** argv)
+{
+	static const struct option options[] = {
+		{ "hex", no_argument, 0, 'x' },
+		{ "summary", no_argument, 0, 's' },
+		{ 0, 0, 0, 0 }
+	};
+	bool hex = false, summary = false;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", options, 0)) != -1)
+	{
+		switch (option)
+		{
+			case 'x':	hex = true; break;
+			case 's':	summary = true; break;
+			default:
+				printf("usage: %s [--hex] [--summary] LOG\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		printf("usage: %s [--hex] [--summary] LOG\n", argv[0]);
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.open(argv[optind]))
+	{
+		printf("ERROR, %s is not a capture log\n", argv[optind]);
+		return 1;
+	}
+
+	const capture_record_t * record;
+	uint64_t first = 0, last = 0, records = 0;
+
+	while ((record = reader.next()) != 0)
+	{
+		if (records == 0) first = record->monotonic;
+		last = record->monotonic;
+		records++;
+
+		int direction = record->direction == eCaptureTx;
+		frameCount[record->port][direction]++;
+		byteCount[record->port][direction] += record->size;
+		if (!summary) printRecord(record, first, hex);
+	}
+
+	if (summary)
+	{
+		for (int port = 0; port < 256; port++)
+		{
+			for (int direction = 0; direction < 2; direction++)
+			{
+				if (!frameCount[port][direction]) continue;
+				printf("Port %d %s: %llu frames, %llu bytes\n", port, direction ? "TX" : "RX",
+				       (unsigned long long) frameCount[port][direction],
+				       (unsigned long long) byteCount[port][direction]);
+			}
+		}
+	}
+	printf("%llu frames over %.6f s, %zu bytes%s\n", (unsigned long long) records,
+	       (last - first) / 1e9, reader.validEnd(),
+	       reader.truncated() ? ", last record cut short" : "");
+	return 0;
+}
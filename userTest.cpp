@@ -11,6 +11,7 @@
  * Defines
  ****************************************************************************/
 #include "userTest.h"
+#include "Packet.h"
 #include "iProtocol.h"
 #include <iostream>
 #include <cstdint>
@@ -41,7 +42,9 @@ uint8_t *tmp;
  * --Elaborates typedefs located in iProtocol.h
  *
  */
-void startUp(housekeeping_hdr_t *hdr_out) {
+void startUp(const PacketBuilder &out) {
+  housekeeping_hdr_t *hdr_out = out.header();
+
   cout << "####################################################################"
           "#";
   cout << endl;
@@ -136,8 +139,8 @@ uint8_t cinNumber() {
  * --Builds outgoing data header
  *
  * Function params:
- * hdr_out:		Pointer to the first byte of the outgoing packet
- *              --As a housekeeping_hdr_t type, contains a src, dst, cmd, & len
+ * out:			Builder over the outgoing packet
+ *              --Its header contains a src, dst, cmd, & len
  *
  * Function variables:
  * userIN:		Buffer for user inputted destination device (see
@@ -149,8 +152,9 @@ uint8_t cinNumber() {
  * converted number:		Unsigned int based on user input
  *
  */
-uint8_t setupMyPacket(housekeeping_hdr_t *hdr_out,
-                      housekeeping_prio_t *hdr_prio) {
+uint8_t setupMyPacket(const PacketBuilder &out) {
+  housekeeping_hdr_t *hdr_out = out.header();
+
   /* Get user input for message destination */
   cout << "Destination #? " << '\t';
   hdr_out->dst = cinNumber();
@@ -178,7 +182,7 @@ uint8_t setupMyPacket(housekeeping_hdr_t *hdr_out,
         outgoingData[i] = cinNumber();
       }
       /* Match data, if there is any */
-      matchData(hdr_out);
+      matchData(out);
       return hdr_out->len;
 
     } else if (userIN3 == 'n') {
@@ -195,17 +199,17 @@ uint8_t setupMyPacket(housekeeping_hdr_t *hdr_out,
  *   reads off the contents of the header (src, dst, cmd, len)
  *
  * Function params:
- * hdr_in:		Pointer to the first byte of the incoming packet
- *              --As a housekeeping_hdr_t type, contains a src, dst, cmd, & len
+ * packet:		View of the incoming packet
+ *              --Its header contains a src, dst, cmd, & len
  *
  */
-void justReadHeader(housekeeping_hdr_t *hdr_in) {
+void justReadHeader(const PacketView &packet) {
   cout << "Reading in packet header... " << endl;
   /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl << endl;
+  cout << "Packet source: " << (int)packet.src() << endl;
+  cout << "Intended destination: " << (int)packet.dst() << endl;
+  cout << "Command : " << (int)packet.cmd() << endl;
+  cout << "Length of data attached: " << (int)packet.len() << endl << endl;
 }
 
 /* Function flow:
@@ -213,13 +217,14 @@ void justReadHeader(housekeeping_hdr_t *hdr_in) {
  *   attached two bytes that describe the command changed and its new priority
  *
  * Function params:
- * hdr_in:		Pointer to the first byte of the incoming packet
- * hdr_prio:	Pointer to the first byte of the priority change information
+ * packet:		View of the incoming packet. Its payload is the priority
+ *              change information
 
  */
-void whatToDoIfSetPriority(housekeeping_hdr_t *hdr_in,
-                           housekeeping_prio_t *hdr_prio) {
-  cout << "Device #" << (int)hdr_in->src;
+void whatToDoIfSetPriority(const PacketView &packet) {
+  const housekeeping_prio_t *hdr_prio = packet.priority();
+
+  cout << "Device #" << (int)packet.src();
   cout << " has successfully changed command #" << (int)hdr_prio->command;
   cout << " to priority #" << (int)hdr_prio->prio_type << "." << endl << endl;
 }
@@ -230,8 +235,8 @@ void whatToDoIfSetPriority(housekeeping_hdr_t *hdr_in,
  * --It then reads off the data attached in the packet
  *
  * Function params:
- * hdr_in:		Pointer to the first byte of the incoming packet
- *              --As a housekeeping_hdr_t type, contains a src, dst, cmd, & len
+ * packet:		View of the incoming packet
+ *              --Its header contains a src, dst, cmd, & len
  *
  * Function variables:
  * TempRead:	Buffer to put the incoming unsigned 32-bit temperature reading
@@ -241,20 +246,20 @@ void whatToDoIfSetPriority(housekeeping_hdr_t *hdr_in,
  * TempF: Float for converted temperature in Fahreheit
  *
  */
-void whatToDoIfISR(housekeeping_hdr_t *hdr_in) {
+void whatToDoIfISR(const PacketView &packet) {
   cout << "Reading in packet header... " << endl;
   /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
-  cout << "Internal temperature of device #" << (int)hdr_in->src << ": ";
+  cout << "Packet source: " << (int)packet.src() << endl;
+  cout << "Intended destination: " << (int)packet.dst() << endl;
+  cout << "Command : " << (int)packet.cmd() << endl;
+  cout << "Length of data attached: " << (int)packet.len() << endl;
+  cout << "Internal temperature of device #" << (int)packet.src() << ": ";
 
   TempRead = 0;
   tmp = (uint8_t *)&TempRead;
 
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
+  for (int i = 0; i < packet.len(); i++) {
+    *tmp = packet.payload()[i];
     tmp = tmp + 1;
   }
 
@@ -264,147 +269,101 @@ void whatToDoIfISR(housekeeping_hdr_t *hdr_in) {
   cout << TempF << " Farenheit." << endl << endl;
 }
 
-void whatToDoIfThermistorsTest(housekeeping_hdr_t *hdr_in) {
+/* Function flow:
+ * --Reads off the header of a telemetry packet before its values
+ */
+static void printTelemetryHeader(const PacketView &packet) {
   cout << "Reading in packet header... " << endl;
   /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
+  cout << "Packet source: " << (int)packet.src() << endl;
+  cout << "Intended destination: " << (int)packet.dst() << endl;
+  cout << "Command : " << (int)packet.cmd() << endl;
+  cout << "Length of data attached: " << (int)packet.len() << endl;
+}
+
+/* Function flow:
+ * --Prints the raw payload bytes, then the float they hold (see
+ *   float_payload_t). The command table only lets 4-byte payloads through
+ *
+ * Function params:
+ * packet:		View of the incoming packet
+ *
+ */
+void whatToDoIfThermistorsTest(const PacketView &packet) {
+  printTelemetryHeader(packet);
   cout << "converting to float resistance value in ohms (first appears the raw bytes) : " << endl;
-  uint8_t array_temp[4];
-  float res=0;
-  tmp = (uint8_t *)array_temp;
-// reverse the bytes for float conversion ugh
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
-    cout << (int) *tmp << endl;
-    tmp = tmp + 1;
+  for (int i = 0; i < packet.len(); i++) {
+    cout << (int)packet.payload()[i] << endl;
   }
-  memcpy(&res,&array_temp,4);
-  cout << res << endl;
-
-// use a union?
-
+  auto [resistance] = float_payload_t::decode(packet.payload(), packet.len());
+  cout << resistance << endl;
 }
 
-void whatToDoIfTempProbes(housekeeping_hdr_t *hdr_in){
-  cout << "Reading in packet header... " << endl;
-  /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
+void whatToDoIfTempProbes(const PacketView &packet){
+  printTelemetryHeader(packet);
   cout << "converting to float (first appears the raw bytes) : " << endl;
-  uint8_t array_temp[4];
-  float res=0;
-  tmp = (uint8_t *)array_temp;
-
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
-    cout << (int) *tmp << endl;
-    tmp = tmp + 1;
+  for (int i = 0; i < packet.len(); i++) {
+    cout << (int)packet.payload()[i] << endl;
   }
-  memcpy(&res,&array_temp,4);
-  cout << res << endl;
-
+  auto [temperature] = float_payload_t::decode(packet.payload(), packet.len());
+  cout << temperature << endl;
 }
 
-void whatToDoIfFloat(housekeeping_hdr_t *hdr_in){
-  cout << "Reading in packet header... " << endl;
-  /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
+void whatToDoIfFloat(const PacketView &packet){
+  printTelemetryHeader(packet);
   cout << "converting to float (first appears the raw bytes) : " << endl;
-  uint8_t array_temp[4];
-  float res=0;
-  tmp = (uint8_t *)array_temp;
-
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
-    cout << "raw byte " << i << ": "  << (int) *tmp << endl;
-    tmp = tmp + 1;
+  for (int i = 0; i < packet.len(); i++) {
+    cout << "raw byte " << i << ": "  << (int)packet.payload()[i] << endl;
   }
-  memcpy(&res,&array_temp,4);
-  cout << "float: " << res << endl;
-
+  auto [value] = float_payload_t::decode(packet.payload(), packet.len());
+  cout << "float: " << value << endl;
 }
 
-void whatToDoIfPressure(housekeeping_hdr_t *hdr_in){
+/* Function flow:
+ * --The last payload byte is the board's status: 0 means the bytes before
+ *   it are a reading (see pressure_payload_t / flow_payload_t), anything
+ *   else means they are an error message
+ * --Returns TRUE if the packet holds a reading with room for the schema
+ *
+ */
+template <typename Payload>
+static bool holdsReading(const PacketView &packet) {
+  size_t len = packet.len();
+
+  if (len == 0 || packet.payload()[len - 1] != 0) {
+    auto [message] = status_text_t::decode(packet.payload(), len);
+    cout << message;
+    return false;
+  }
+  if (!Payload::fits(len - 1)) {
+    cout << "Reading needs " << Payload::size << " bytes + status, got " << len;
+    return false;
+  }
+  return true;
+}
 
-  cout << "Reading in packet header... " << endl;
-  /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
+void whatToDoIfPressure(const PacketView &packet){
+  printTelemetryHeader(packet);
   cout << "converting to readable format : " << endl;
-  uint8_t array_t[hdr_in->len];
-  double pressure_value=0;
-  double temperature_value=0;
-  char typeOfPressure;
-  char error_code[100];
-
-  tmp = (uint8_t *)array_t;
-
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
-//    cout << (int) *tmp << endl;
-    tmp = tmp + 1;
-  }
 
-  if(array_t[hdr_in->len-1]==0){
-    memcpy(&pressure_value,&array_t,sizeof(pressure_value));
-    memcpy(&temperature_value,&array_t+sizeof(pressure_value),sizeof(temperature_value));
-    memcpy(&typeOfPressure,&array_t+sizeof(pressure_value)+sizeof(temperature_value),sizeof(typeOfPressure));
-    cout << "Pressure: " << pressure_value << " , " << temperature_value << " , " << typeOfPressure << endl;
-  }
-  else{
-    memcpy(&error_code,&array_t,sizeof(error_code));
-    for(int i =0; i<100; i++) {
-      cout << error_code[i];
-    }
+  if (holdsReading<pressure_payload_t>(packet)) {
+    auto [pressure, temperature, typeOfPressure] =
+        pressure_payload_t::decode(packet.payload(), packet.len() - 1);
+    cout << "Pressure: " << pressure << " , " << temperature << " , " << typeOfPressure << endl;
   }
   cout << " " << endl;
   cout << "DONE" << endl;
 
 }
-void whatToDoIfFlow(housekeeping_hdr_t *hdr_in){
-  cout << "Reading in packet header... " << endl;
-  /* Read off header data */
-  cout << "Packet source: " << (int)hdr_in->src << endl;
-  cout << "Intended destination: " << (int)hdr_in->dst << endl;
-  cout << "Command : " << (int)hdr_in->cmd << endl;
-  cout << "Length of data attached: " << (int)hdr_in->len << endl;
+void whatToDoIfFlow(const PacketView &packet){
+  printTelemetryHeader(packet);
   cout << "converting to readable format : " << endl;
-  uint8_t array_t[hdr_in->len];
-  double gas_data[4];
-  char gas_type[100];
-  char error_code[100];
-  tmp = (uint8_t *)array_t;
-
-  for (int i = 0; i < hdr_in->len; i++) {
-    *tmp = *((uint8_t *)hdr_in + 4 + i);
-//    cout << (int) *tmp << " , ";
-    tmp = tmp + 1;
-  }
 
-  if(array_t[hdr_in->len-1]==0){
-    memcpy(&gas_data,&array_t,sizeof(gas_data));
-    memcpy(&gas_type,&array_t+sizeof(gas_data),sizeof(gas_type));
-    cout << "Gas Data: " << gas_data[0] << " , " << gas_data[1] << " , " << gas_data[2] << " , " << gas_data[3] << endl;
-    cout << "Gas Type: ";
-    for(int i =0; i<100; i++) {
-      cout << gas_type[i];
-    }
-  }
-  else{
-    memcpy(&error_code,&array_t,sizeof(error_code));
-    for(int i =0; i<100; i++) {
-      cout << error_code[i];
-    }
+  if (holdsReading<flow_payload_t>(packet)) {
+    auto [gas0, gas1, gas2, gas3, gasType] =
+        flow_payload_t::decode(packet.payload(), packet.len() - 1);
+    cout << "Gas Data: " << gas0 << " , " << gas1 << " , " << gas2 << " , " << gas3 << endl;
+    cout << "Gas Type: " << gasType;
   }
   cout << " " << endl;
   cout << "DONE" << endl;
@@ -416,14 +375,16 @@ void whatToDoIfFlow(housekeeping_hdr_t *hdr_in){
  *   received and prints out a log of all errors in this program's instance
  *
  * Function params:
- * hdr_err:		Pointer to the first byte of the error diagnostic
- * received
+ * packet:		View of the incoming packet. Its payload is the error
+ * diagnostic received
  * errors:		Array of past errors. The current error gets put in the
  * array numErrors:	Number of errors total
  *
  */
-void whatToDoIfError(housekeeping_err_t *hdr_err, uint8_t *errors,
+void whatToDoIfError(const PacketView &packet, uint8_t *errors,
                      uint8_t &numError) {
+  const housekeeping_err_t *hdr_err = packet.error();
+
   /* Throw an error */
   cout << "Error received: Type " << (int)hdr_err->error - 256 << endl << endl;
 
@@ -457,14 +418,14 @@ void whatToDoIfError(housekeeping_err_t *hdr_err, uint8_t *errors,
  * both
  *
  * Function params:
- * hdr_in:		Pointer to the first byte of the incoming packet
+ * packet:		View of the incoming packet
  *
  */
-void whatToDoIfMap(housekeeping_hdr_t *hdr_in) {
-  cout << "Device #" << (int)hdr_in->src << " has attached devices:" << endl;
+void whatToDoIfMap(const PacketView &packet) {
+  cout << "Device #" << (int)packet.src() << " has attached devices:" << endl;
 
-  for (int i = 0; i < hdr_in->len; i++) {
-    cout << (int)*((uint8_t *)hdr_in + 4 + i) << endl;
+  for (int i = 0; i < packet.len(); i++) {
+    cout << (int)packet.payload()[i] << endl;
   }
   cout << endl;
 }
@@ -473,30 +434,30 @@ void whatToDoIfMap(housekeeping_hdr_t *hdr_in) {
  * --Sets the outgoing header so that all devices receive the eReset command.
  *
  * Function params:
- * hdr_out:         Pointer to the first byte of the outgoing packet
+ * out:             Builder over the outgoing packet
  *
  */
-void resetAll(housekeeping_hdr_t *hdr_out) {
-  hdr_out->dst = eBroadcast;
-  hdr_out->cmd = eReset;
-  hdr_out->len = 0;
+void resetAll(const PacketBuilder &out) {
+  out.header()->dst = eBroadcast;
+  out.header()->cmd = eReset;
+  out.header()->len = 0;
 }
 
 /* Function flow:
- * --Matches an array of data with the (global) outgoingPacket data slots
+ * --Matches an array of data with the outgoing packet's payload slots
  * --Requires outgoingData as a global uint8_tarray
  *
  * Function params:
- * hdr_out:		Pointer to the first byte of the incoming packet
- *              --As a housekeeping_hdr_t type, contains a src, dst, cmd, & len
+ * out:			Builder over the outgoing packet
+ *              --Its header contains a src, dst, cmd, & len
  *
  * Function variables:
  * ptr:			Dummy pointer to where we want to put this byte in the
  *outgoing packet. Gets iterated over
  *
  */
-void matchData(housekeeping_hdr_t *hdr_out) {
-  for (int i = 0; i < hdr_out->len; i++) {
-    *((uint8_t *)hdr_out + 4 + i) = outgoingData[i];
+void matchData(const PacketBuilder &out) {
+  for (int i = 0; i < out.header()->len; i++) {
+    out.payload()[i] = outgoingData[i];
   }
 }
@@ -10,47 +10,64 @@
 
 #pragma once
 
-#include "iProtocol.h"
+#include "Packet.h"
+#include "PayloadSchema.h"
 #include <iostream>
 
+/* Payload layouts of the board-specific telemetry (see PayloadSchema.h) */
+
+/* One float: thermistor resistance in ohms (DCT board), temperature probes
+ * and the other magnet board readings */
+typedef Schema<Field<float, 0>> float_payload_t;
+
+/* Pressure, temperature and pressure type, then a status byte */
+typedef Schema<Field<double, 0>, Field<double, 8>, Field<char, 16>> pressure_payload_t;
+
+/* Four gas readings and the gas name, then a status byte */
+typedef Schema<Field<double, 0>, Field<double, 8>, Field<double, 16>,
+               Field<double, 24>, Text<32, 100>> flow_payload_t;
+
+/* What a board sends instead when its status byte is not 0 */
+typedef Schema<Text<0, 100>> status_text_t;
+
 /* Startup function for user interface */
-void startUp(housekeeping_hdr_t * hdr_out);
+void startUp(const PacketBuilder & out);
 
 /* Setting the interface protocol for this device */
-uint8_t setupMyPacket(housekeeping_hdr_t * hdr_out, housekeeping_prio_t * hdr_prio);
+uint8_t setupMyPacket(const PacketBuilder & out);
 
 /* Called to display information from a packet header */
-void justReadHeader(housekeeping_hdr_t * hdr_in);
+void justReadHeader(const PacketView & packet);
 
 /* This device's response to fake sensor read command */
-void whatToDoIfISR(housekeeping_hdr_t * hdr_in);
+void whatToDoIfISR(const PacketView & packet);
 
 /* This response to convert 4 byte thermistor resistances to floats */
-void whatToDoIfThermistorsTest(housekeeping_hdr_t * hdr_in);
+void whatToDoIfThermistorsTest(const PacketView & packet);
 
 /* This response to convert 4 byte temp probes to floats */
-void whatToDoIfTempProbes(housekeeping_hdr_t * hdr_in);
+void whatToDoIfTempProbes(const PacketView & packet);
 
 /* This response to convert 4 byte temp probes to floats */
-void whatToDoIfFloat(housekeeping_hdr_t * hdr_in);
+void whatToDoIfFloat(const PacketView & packet);
 
 /* This response to convert 4 byte temp probes to floats */
-void whatToDoIfPressure(housekeeping_hdr_t * hdr_in);
+void whatToDoIfPressure(const PacketView & packet);
 
 /* This response to convert 4 byte temp probes to floats */
-void whatToDoIfFlow(housekeeping_hdr_t * hdr_in);
+void whatToDoIfFlow(const PacketView & packet);
 
 /* Displays the result of a set priority command */
-void whatToDoIfSetPriority(housekeeping_hdr_t * hdr_in, housekeeping_prio_t * hdr_prio);
+void whatToDoIfSetPriority(const PacketView & packet);
 
 /* Reads out the error type received + prints a log of all errors since startup */
-void whatToDoIfError(housekeeping_err_t * hdr_err, uint8_t * errorsReceived, uint8_t & numError);
+void whatToDoIfError(const PacketView & packet, uint8_t * errorsReceived, uint8_t & numError);
 
 /* Reads out the device map received from a device */
-void whatToDoIfMap(housekeeping_hdr_t * hdr_in);
+void whatToDoIfMap(const PacketView & packet);
 
 /* Sets up a reset command going to all devices */
-void resetAll(housekeeping_hdr_t * hdr_out);
+void resetAll(const PacketBuilder & out);
 
 /* Puts the outgoing data inside the outgoing packet */
-void matchData(housekeeping_hdr_t * hdr_out);
+void matchData(const PacketBuilder & out);
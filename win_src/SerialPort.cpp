@@ -153,7 +153,8 @@ int SerialPort::update(uint8_t *decodeBuffer)
 			/* Decode the packet */
 			size_t numDecoded = COBS::decode(_receiveBuffer,
 			                                 _receiveBufferIndex,
-			                                 decodeBuffer);
+			                                 decodeBuffer,
+			                                 MAX_PACKET_LENGTH);
 
 			/* If there are not enough bytes in a packet for a header, it might
 			   be a phantom signal? */
@@ -16,12 +16,12 @@
 /* Max data length is:
  *	--4 header bytes
  *	-- + 255 data bytes
- *  -- + 1 CRC (checksum) byte
+ *  -- + 1 checksum byte, or up to 4 CRC bytes (see integrity_mode_t)
  * For max packet size,
  *	-- +1 COBS overhead
  *	-- +1 COBS packet marker
  */
-#define MAX_PACKET_LENGTH (4 + 255 + 1) + 2
+#define MAX_PACKET_LENGTH (4 + 255 + 4) + 2
 
 /* define WAIT_TIME for time to wait after connecting to board */
 #define WAIT_TIME 2000